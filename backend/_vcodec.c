@@ -0,0 +1,610 @@
+// _vcodec.c
+/*
+ * Python bindings to libvcodec (test_c/first_iter/vcodec.h), used by
+ * NativeVideoEncoder in video_encoder.py. Frames are passed as any object
+ * with the buffer protocol, e.g. bytes or a NumPy array, without a copy,
+ * and the GIL is released while frames are encoded or decoded.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "vcodec.h"
+
+/**
+ * @struct out_buffer
+ * @brief: Encoded bytes written since they were last handed to Python
+ *
+ * @param data: Bytes written
+ * @param size: Number of bytes in @data
+ * @param capacity: Allocated size of @data
+ */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} out_buffer;
+
+/* _vcodec.Encoder */
+typedef struct {
+    PyObject_HEAD
+    vc_encoder *enc;
+    out_buffer out;
+    vc_format format;
+    int width;
+    int height;
+    size_t frame_bytes;
+    int busy;
+} EncoderObject;
+
+/* _vcodec.Decoder */
+typedef struct {
+    PyObject_HEAD
+    vc_decoder *dec;
+    PyObject *file;
+    vc_format format;
+    vc_stream_info info;
+    size_t frame_bytes;
+    int busy;
+} DecoderObject;
+
+/**
+ * parse_format - Map a format name to a vc_format
+ * @name: "rgb24" or "yuv420p"
+ * @format: Pointer to store the format
+ *
+ * Return: 0 on success, -1 with ValueError set for an unknown name
+ */
+static int parse_format(const char *name, vc_format *format)
+{
+    if (strcmp(name, "rgb24") == 0) {
+        *format = VC_FORMAT_RGB24;
+    } else if (strcmp(name, "yuv420p") == 0) {
+        *format = VC_FORMAT_YUV420P;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unknown frame format %s", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * frame_layout - Planes and strides of one packed frame
+ * @format: Frame format
+ * @width: Frame width in pixels
+ * @height: Frame height in pixels
+ * @data: Frame, or NULL to only get its size
+ * @planes: Pointers to store the start of each plane
+ * @strides: Pointers to store the row size of each plane
+ *
+ * Return: Size of the frame in bytes
+ */
+static size_t frame_layout(vc_format format, int width, int height, unsigned char *data, unsigned char *planes[3],
+                           int strides[3])
+{
+    size_t luma = (size_t)width * height;
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+    if (format == VC_FORMAT_RGB24) {
+        planes[0] = data;
+        planes[1] = planes[2] = NULL;
+        strides[0] = width * 3;
+        strides[1] = strides[2] = 0;
+        return luma * 3;
+    }
+
+    planes[0] = data;
+    planes[1] = data ? data + luma : NULL;
+    planes[2] = data ? data + luma + (size_t)cw * ch : NULL;
+    strides[0] = width;
+    strides[1] = strides[2] = cw;
+
+    return luma + 2 * (size_t)cw * ch;
+}
+
+/**
+ * write_out - Keep bytes of the encoded stream until Python takes them
+ * @opaque: Output buffer
+ * @data: Bytes to write
+ * @size: Number of bytes
+ *
+ * Called with the GIL released, so it only touches C memory.
+ *
+ * Return: 0 on success, -1 if out of memory
+ */
+static int write_out(void *opaque, const unsigned char *data, size_t size)
+{
+    out_buffer *out = opaque;
+
+    if (out->size + size > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity : 65536;
+        unsigned char *grown;
+
+        while (capacity < out->size + size)
+            capacity *= 2;
+        grown = realloc(out->data, capacity);
+        if (!grown)
+            return -1;
+        out->data = grown;
+        out->capacity = capacity;
+    }
+
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+
+    return 0;
+}
+
+/**
+ * take_output - Hand the bytes written so far to Python
+ * @self: Encoder
+ *
+ * Return: New bytes object, or NULL with an exception set
+ */
+static PyObject *take_output(EncoderObject *self)
+{
+    PyObject *bytes = PyBytes_FromStringAndSize((const char *)self->out.data, self->out.size);
+
+    if (bytes)
+        self->out.size = 0;
+
+    return bytes;
+}
+
+/**
+ * claim_encoder - Check the encoder can be used by this call
+ * @self: Encoder
+ *
+ * The GIL is released while it works, so a second thread could call in.
+ *
+ * Return: 0 if it can, -1 with RuntimeError set
+ */
+static int claim_encoder(EncoderObject *self)
+{
+    if (!self->enc) {
+        PyErr_SetString(PyExc_RuntimeError, "Encoder is closed");
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Encoder is in use by another thread");
+        return -1;
+    }
+    self->busy = 1;
+
+    return 0;
+}
+
+/**
+ * Encoder_init - Encoder(width, height, gop_size=50, fps=25.0, threads=1, format="rgb24")
+ * @self: Encoder
+ * @args: Positional arguments
+ * @kwds: Keyword arguments
+ *
+ * Return: 0 on success, -1 with an exception set
+ */
+static int Encoder_init(EncoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"width", "height", "gop_size", "fps", "threads", "format", NULL};
+    /* defaults as documented, only an explicit gop_size of 0 is refused */
+    vc_encoder_params params = {.gop_size = 50};
+    const char *format = "rgb24";
+    unsigned char *planes[3];
+    int strides[3];
+
+    if (self->enc) {
+        PyErr_SetString(PyExc_RuntimeError, "Encoder already started");
+        return -1;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|idis", kwlist, &params.width, &params.height,
+                                     &params.gop_size, &params.fps, &params.threads, &format))
+        return -1;
+    if (params.width <= 0 || params.height <= 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid video dimensions");
+        return -1;
+    }
+    if (params.gop_size < 1) {
+        PyErr_SetString(PyExc_ValueError, "GOP size must be at least 1");
+        return -1;
+    }
+    if (parse_format(format, &params.format) != 0)
+        return -1;
+
+    params.write = write_out;
+    params.opaque = &self->out;
+    self->format = params.format;
+    self->width = params.width;
+    self->height = params.height;
+    self->frame_bytes = frame_layout(params.format, params.width, params.height, NULL, planes, strides);
+
+    /* writes the stream header into self->out */
+    self->enc = vc_encoder_create(&params);
+    if (!self->enc) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to start the encoder");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Encoder_encode - Encoder.encode(frames) -> bytes
+ * @self: Encoder
+ * @arg: Buffer holding one or more packed frames back to back
+ *
+ * The frames are read in place and the GIL is released while they are
+ * encoded, so other threads run meanwhile.
+ *
+ * Return: Encoded bytes ready so far, often empty, or NULL with an
+ * exception set
+ */
+static PyObject *Encoder_encode(EncoderObject *self, PyObject *arg)
+{
+    Py_buffer view;
+    size_t count;
+    int ret = 0;
+
+    if (PyObject_GetBuffer(arg, &view, PyBUF_CONTIG_RO) != 0)
+        return NULL;
+    if ((size_t)view.len % self->frame_bytes != 0) {
+        PyErr_Format(PyExc_ValueError, "Buffer of %zd bytes is not a whole number of %zu byte frames", view.len,
+                     self->frame_bytes);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    if (claim_encoder(self) != 0) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    count = view.len / self->frame_bytes;
+
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        unsigned char *planes[3];
+        int strides[3];
+
+        frame_layout(self->format, self->width, self->height, (unsigned char *)view.buf + i * self->frame_bytes,
+                     planes, strides);
+        ret = vc_encode_frame(self->enc, (const unsigned char *const *)planes, strides);
+    }
+    Py_END_ALLOW_THREADS
+
+    self->busy = 0;
+    PyBuffer_Release(&view);
+    if (ret != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to encode frame");
+        return NULL;
+    }
+
+    return take_output(self);
+}
+
+/**
+ * Encoder_flush - Encoder.flush() -> bytes
+ * @self: Encoder
+ * @unused: No arguments
+ *
+ * Finishes the stream, no more frames can be encoded afterwards.
+ *
+ * Return: The rest of the encoded stream, or NULL with an exception set
+ */
+static PyObject *Encoder_flush(EncoderObject *self, PyObject *Py_UNUSED(unused))
+{
+    int ret;
+
+    if (claim_encoder(self) != 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = vc_flush(self->enc);
+    Py_END_ALLOW_THREADS
+
+    self->busy = 0;
+    if (ret != 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to finish the stream");
+        return NULL;
+    }
+
+    return take_output(self);
+}
+
+/**
+ * Encoder_frame_count - Encoder.frame_count, frames encoded so far
+ * @self: Encoder
+ * @closure: Unused
+ *
+ * Return: Frame count
+ */
+static PyObject *Encoder_frame_count(EncoderObject *self, void *closure)
+{
+    (void)closure;
+
+    return PyLong_FromLong(self->enc ? vc_encoder_frame_count(self->enc) : 0);
+}
+
+/**
+ * Encoder_dealloc - Release an encoder
+ * @self: Encoder
+ */
+static void Encoder_dealloc(EncoderObject *self)
+{
+    vc_encoder_destroy(self->enc);
+    free(self->out.data);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef Encoder_methods[] = {
+    {"encode", (PyCFunction)Encoder_encode, METH_O,
+     "encode(frames) -> bytes\n\nEncode one or more packed frames, returns the stream bytes ready so far."},
+    {"flush", (PyCFunction)Encoder_flush, METH_NOARGS,
+     "flush() -> bytes\n\nFinish the stream, returns the rest of it."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Encoder_getset[] = {
+    {"frame_count", (getter)Encoder_frame_count, NULL, "Frames encoded so far", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject EncoderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_vcodec.Encoder",
+    .tp_doc = "Encoder(width, height, gop_size=50, fps=25.0, threads=1, format='rgb24')\n\n"
+              "Frame at a time encoder writing the container read by VideoEncoder.",
+    .tp_basicsize = sizeof(EncoderObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Encoder_init,
+    .tp_dealloc = (destructor)Encoder_dealloc,
+    .tp_methods = Encoder_methods,
+    .tp_getset = Encoder_getset,
+};
+
+/**
+ * read_in - Fill the decoder input from the Python file
+ * @opaque: Decoder
+ * @data: Buffer to fill
+ * @size: Bytes wanted
+ *
+ * Called with the GIL released, so it takes the GIL back for the read.
+ * A failed read leaves its exception set for the caller to raise.
+ *
+ * Return: Number of bytes stored, 0 at the end or on failure
+ */
+static size_t read_in(void *opaque, unsigned char *data, size_t size)
+{
+    DecoderObject *self = opaque;
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *view, *ret;
+    size_t got = 0;
+
+    view = PyMemoryView_FromMemory((char *)data, size, PyBUF_WRITE);
+    if (view) {
+        ret = PyObject_CallMethod(self->file, "readinto", "O", view);
+        if (ret && ret != Py_None)
+            got = PyLong_AsSize_t(ret);
+        if (PyErr_Occurred())
+            got = 0;
+        Py_XDECREF(ret);
+        Py_DECREF(view);
+    }
+
+    PyGILState_Release(gil);
+
+    return got;
+}
+
+/**
+ * claim_decoder - Check the decoder can be used by this call
+ * @self: Decoder
+ *
+ * Return: 0 if it can, -1 with RuntimeError set
+ */
+static int claim_decoder(DecoderObject *self)
+{
+    if (!self->dec) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is closed");
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is in use by another thread");
+        return -1;
+    }
+    self->busy = 1;
+
+    return 0;
+}
+
+/**
+ * Decoder_init - Decoder(file, format="yuv420p", threads=1)
+ * @self: Decoder
+ * @args: Positional arguments
+ * @kwds: Keyword arguments
+ *
+ * @file is anything with readinto(), read front to back, so it may be a
+ * pipe. The stream header is read straight away.
+ *
+ * Return: 0 on success, -1 with an exception set
+ */
+static int Decoder_init(DecoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"file", "format", "threads", NULL};
+    vc_decoder_params params = {0};
+    const char *format = "yuv420p";
+    PyObject *file;
+    unsigned char *planes[3];
+    int strides[3];
+
+    if (self->dec) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder already started");
+        return -1;
+    }
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|si", kwlist, &file, &format, &params.threads))
+        return -1;
+    if (parse_format(format, &params.format) != 0)
+        return -1;
+
+    Py_INCREF(file);
+    self->file = file;
+    self->format = params.format;
+    params.read = read_in;
+    params.opaque = self;
+
+    Py_BEGIN_ALLOW_THREADS
+    self->dec = vc_decoder_create(&params);
+    Py_END_ALLOW_THREADS
+
+    if (!self->dec) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "Invalid compressed stream header");
+        return -1;
+    }
+
+    vc_decoder_info(self->dec, &self->info);
+    self->frame_bytes = frame_layout(self->format, self->info.width, self->info.height, NULL, planes, strides);
+
+    return 0;
+}
+
+/**
+ * Decoder_decode_into - Decoder.decode_into(frame) -> bool
+ * @self: Decoder
+ * @arg: Writable buffer of at least frame_bytes bytes
+ *
+ * The next frame is written straight into @arg, packed, with the GIL
+ * released while it is decoded.
+ *
+ * Return: True if a frame was decoded, False at the end of the stream,
+ * or NULL with an exception set
+ */
+static PyObject *Decoder_decode_into(DecoderObject *self, PyObject *arg)
+{
+    unsigned char *planes[3];
+    int strides[3];
+    Py_buffer view;
+    int ret;
+
+    if (PyObject_GetBuffer(arg, &view, PyBUF_CONTIG) != 0)
+        return NULL;
+    if ((size_t)view.len < self->frame_bytes) {
+        PyErr_Format(PyExc_ValueError, "Buffer of %zd bytes is smaller than a %zu byte frame", view.len,
+                     self->frame_bytes);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    if (claim_decoder(self) != 0) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    frame_layout(self->format, self->info.width, self->info.height, view.buf, planes, strides);
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = vc_decode_frame(self->dec, planes, strides);
+    Py_END_ALLOW_THREADS
+
+    self->busy = 0;
+    PyBuffer_Release(&view);
+    if (PyErr_Occurred())
+        return NULL;
+    if (ret < 0) {
+        PyErr_SetString(PyExc_ValueError, "Invalid compressed stream");
+        return NULL;
+    }
+
+    return PyBool_FromLong(ret);
+}
+
+/**
+ * Decoder_dealloc - Release a decoder
+ * @self: Decoder
+ */
+static void Decoder_dealloc(DecoderObject *self)
+{
+    vc_decoder_destroy(self->dec);
+    Py_XDECREF(self->file);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/**
+ * Decoder_get_info - Getter of one field of the stream header
+ * @self: Decoder
+ * @closure: Name of the field
+ *
+ * Return: Value of the field
+ */
+static PyObject *Decoder_get_info(DecoderObject *self, void *closure)
+{
+    const char *name = closure;
+
+    if (strcmp(name, "fps") == 0)
+        return PyFloat_FromDouble(self->info.fps);
+    if (strcmp(name, "frame_bytes") == 0)
+        return PyLong_FromSize_t(self->frame_bytes);
+
+    return PyLong_FromLong(strcmp(name, "width") == 0    ? self->info.width
+                           : strcmp(name, "height") == 0 ? self->info.height
+                                                          : self->info.gop_size);
+}
+
+static PyMethodDef Decoder_methods[] = {
+    {"decode_into", (PyCFunction)Decoder_decode_into, METH_O,
+     "decode_into(frame) -> bool\n\nDecode the next frame into a writable buffer, False at the end."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Decoder_getset[] = {
+    {"width", (getter)Decoder_get_info, NULL, "Frame width from the stream header", "width"},
+    {"height", (getter)Decoder_get_info, NULL, "Frame height from the stream header", "height"},
+    {"fps", (getter)Decoder_get_info, NULL, "Frame rate from the stream header, 0 if unknown", "fps"},
+    {"gop_size", (getter)Decoder_get_info, NULL, "Frames per key frame", "gop_size"},
+    {"frame_bytes", (getter)Decoder_get_info, NULL, "Size of one decoded frame", "frame_bytes"},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject DecoderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_vcodec.Decoder",
+    .tp_doc = "Decoder(file, format='yuv420p', threads=1)\n\n"
+              "Frame at a time decoder of the container written by VideoEncoder.",
+    .tp_basicsize = sizeof(DecoderObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)Decoder_init,
+    .tp_dealloc = (destructor)Decoder_dealloc,
+    .tp_methods = Decoder_methods,
+    .tp_getset = Decoder_getset,
+};
+
+static struct PyModuleDef vcodec_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_vcodec",
+    .m_doc = "Native encoder and decoder behind NativeVideoEncoder",
+    .m_size = -1,
+};
+
+/**
+ * PyInit__vcodec - Module init
+ *
+ * Return: The module, or NULL on failure
+ */
+PyMODINIT_FUNC PyInit__vcodec(void)
+{
+    PyObject *module;
+
+    if (PyType_Ready(&EncoderType) < 0 || PyType_Ready(&DecoderType) < 0)
+        return NULL;
+
+    module = PyModule_Create(&vcodec_module);
+    if (!module)
+        return NULL;
+
+    Py_INCREF(&EncoderType);
+    Py_INCREF(&DecoderType);
+    if (PyModule_AddObject(module, "Encoder", (PyObject *)&EncoderType) < 0 ||
+        PyModule_AddObject(module, "Decoder", (PyObject *)&DecoderType) < 0) {
+        Py_DECREF(&EncoderType);
+        Py_DECREF(&DecoderType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
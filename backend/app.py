@@ -1,24 +1,30 @@
-from flask import Flask, request, render_template, send_from_directory, redirect, url_for, jsonify
+from flask import Flask, Response, request, render_template, send_from_directory, redirect, url_for, jsonify, stream_with_context
 import os
 import logging
+from werkzeug.exceptions import NotFound
 from werkzeug.utils import secure_filename
-from video_encoder import VideoEncoder
+from video_encoder import OUTPUT_FORMATS
+from jobs import Codec, JobStore, JOBS_DB, MAX_QUEUED_JOBS
+from cache import ResultCache, CACHE_DB, upload_key
 from functools import wraps
 import magic
 import json
+import uuid
+import zlib
 
 # config
-UPLOAD_FOLDER = "uploads"
+UPLOAD_FOLDER = "uploads"  # uploads waiting for a background job
 COMPRESSED_FOLDER = "compressed"
 DECOMPRESSED_FOLDER = "decompressed"
 ALLOWED_EXTENSIONS = {"rgb24","bin"}
+OUTPUT_EXTENSIONS = {"rgb24": "rgb24", "yuv420p": "yuv", "nv12": "nv12"}
 MAX_FILE_SIZE = 100 * 1024 * 1024 # 100MB
+MAGIC_BYTES = 2048  # bytes of an upload its content type is checked from
 
 app = Flask(__name__,
             static_folder="static/dist",
             static_url_path='/')
 
-app.config["UPLOAD_FOLDER"] = UPLOAD_FOLDER
 app.config["MAX_CONTENT_LENGTH"] = MAX_FILE_SIZE
 
 if not os.path.exists(UPLOAD_FOLDER):
@@ -28,6 +34,10 @@ if not os.path.exists(COMPRESSED_FOLDER):
 if not os.path.exists(DECOMPRESSED_FOLDER):
     os.makedirs(DECOMPRESSED_FOLDER)
 
+# queued codec work, run by `python jobs.py`
+jobs = JobStore(JOBS_DB)
+# outputs of earlier requests, kept in COMPRESSED_FOLDER and DECOMPRESSED_FOLDER
+results = ResultCache(CACHE_DB)
 
 logging.basicConfig(level=logging.INFO)
 logger = logging.getLogger(__name__)
@@ -75,13 +85,33 @@ def validate_file_request(f):
         return f(*args, **kwargs)
     return decorated_function
 
+def result_key(file, kind, params):
+    """cache key of an upload and the settings its output depends on, the codec included"""
+    return upload_key(file.stream, kind, dict(params, codec=Codec.__name__))
+
+def cached_path(folder, key, extension):
+    """where the output with a cache key is kept"""
+    return os.path.join(folder, f"{key}.{extension}")
+
+def part_path(path):
+    """file an output is written to until it is complete, unique to the request"""
+    return f"{path}.{uuid.uuid4().hex}.part"
+
+def send_cached(path, **kwargs):
+    """send a cached output, None if it was evicted after it was looked up"""
+    try:
+        return send_from_directory(os.path.dirname(path), os.path.basename(path), **kwargs)
+    except NotFound:
+        logger.info(f"{path} was evicted from the result cache before it was sent")
+        return None
+
 def allowed_file(filename):
     return ('.' in filename and filename.rsplit('.', 1)[1].lower() in ALLOWED_EXTENSIONS)
 
-def validate_file_content(file_path, expected_type):
-    """validate file content using magic numbers"""
+def validate_file_content(head, expected_type):
+    """validate file content using magic numbers in its first bytes"""
     mime = magic.Magic(mime=True)
-    file_type = mime.from_file(file_path)
+    file_type = mime.from_buffer(head)
     
     if expected_type == "rgb24":
         # raw vids may be dectected as var bin types
@@ -108,52 +138,55 @@ def serve(path):
 @app.route("/api/compress", methods=["POST"])
 @validate_file_request
 def compress():
+    tmp_path = None
+    done = False
     try:
         file = request.files['file']
         width = int(request.form['width'])
         height = int(request.form['height'])
-        
-        # save uploaded file
         filename = secure_filename(file.filename)
-        filepath = os.path.join(app.config["UPLOAD_FOLDER"], filename)
-        file.save(filepath)
         
-        # validate file content
-        if not validate_file_content(filepath, 'rgb24'):
-            os.remove(filepath)
+        # validate file content from its first bytes, then encode from the start
+        if not validate_file_content(file.stream.read(MAGIC_BYTES), 'rgb24'):
             return error_response("Invalid file content")
-        
-        # init codec
-        encoder = VideoEncoder(width, height)
-        
-        with open(filepath, 'rb') as f:
-            input_data = f.read()
+        file.stream.seek(0)
 
-        frames = encoder.read_frames(input_data)
-        if not frames:
-            raise VideoProcessingError('No valid frames found in input')
-        compressed_data = encoder.encode_frames(frames)
-
-        # save compressed file
+        # the same upload compressed before is served from the cache
+        key = result_key(file, "compress", {"width": width, "height": height})
         compressed_filename = f"{os.path.splitext(filename)[0]}_compressed.bin"
-        compressed_path = os.path.join(COMPRESSED_FOLDER, compressed_filename)
+        compressed_path = cached_path(COMPRESSED_FOLDER, key, "bin")
+        download_url = f'api/download/compressed/{key}.bin?name={compressed_filename}'
 
-        with open(compressed_path, 'wb') as f:
-            f.write(compressed_data)
+        hit = results.get(key)
+        if hit:
+            return success_response(dict(hit["result"], filename=compressed_filename, download_url=download_url))
+        
+        # init codec
+        encoder = Codec(width, height)
+
+        # encode straight from the upload a frame at a time, writing the
+        # compressed file as it goes, so the upload is never held in memory
+        tmp_path = part_path(compressed_path)
+        with open(tmp_path, 'wb') as out:
+            frame_count = encoder.encode_stream(file.stream, out)
+        if frame_count == 0:
+            raise VideoProcessingError('No valid frames found in input')
 
         # calculate compression stats
-        original_size = os.path.getsize(filepath)
-        compressed_size = os.path.getsize(compressed_path)
+        original_size = file.stream.seek(0, os.SEEK_END)
+        compressed_size = os.path.getsize(tmp_path)
         compression_ratio = (1 - (compressed_size / original_size)) * 100
 
-        response_data = {
-            'filename': compressed_filename,
+        result = {
             'original_size': original_size,
             "compressed_size": compressed_size,
             'compression_ratio': f"{compression_ratio:.2f}%",
-            'frame_count': len(frames),
-            'download_url': f'api/download/compressed/{compressed_filename}'
+            'frame_count': frame_count
         }
+        results.put(key, tmp_path, compressed_path, result)
+        done = True
+
+        response_data = dict(result, filename=compressed_filename, download_url=download_url)
         print("DEBUG compress response: ", response_data)
         
         return success_response(response_data)
@@ -165,11 +198,57 @@ def compress():
         logger.error(f"Unexpected error during compression: {str(e)}")
         return error_response("An unexpected error occured suring compression")
     finally:
-        # clean ups
-        if os.path.exists(filepath):
-            os.remove(filepath)
+        # a failed encode leaves no partial output behind
+        if not done and tmp_path and os.path.exists(tmp_path):
+            os.remove(tmp_path)
     
 
+def decoded_frames(decoder, first, num_frames):
+    """yield decoded frames as bytes, from one already decoded, stopping after num_frames unless it is 0"""
+    frame = first
+    frame_count = 0
+    try:
+        while frame is not None:
+            yield frame.tobytes()
+            frame_count += 1
+            if frame_count == num_frames:
+                return
+            frame = decoder.next_output_frame()
+    except (ValueError, zlib.error) as e:
+        logger.error(f"Stream cut short after {frame_count} frames: {e}")
+        raise VideoProcessingError(f"Invalid compressed stream: {e}")
+
+
+def cached_frames(frames, key, path, output_format):
+    """pass decoded frames through while saving them, the result cache gets the file once the last one has passed"""
+    tmp_path = part_path(path)
+    frame_count = 0
+    done = False
+    try:
+        with open(tmp_path, "wb") as out:
+            for frame in frames:
+                out.write(frame)
+                frame_count += 1
+                yield frame
+            size = out.tell()
+        results.put(key, tmp_path, path, {"frame_count": frame_count, "output_format": output_format, "size": size})
+        done = True
+    finally:
+        # a failed decode or a dropped connection leaves no partial output behind
+        if not done and os.path.exists(tmp_path):
+            os.remove(tmp_path)
+
+
+def stream_headers(width, height, output_format, frame_size):
+    """headers describing the frames of a streamed decompression"""
+    return {
+        "X-Width": str(width),
+        "X-Height": str(height),
+        "X-Output-Format": output_format,
+        "X-Frame-Size": str(frame_size)
+    }
+
+
 @app.route('/api/decompress', methods=['POST'])
 @validate_file_request
 def decompress():
@@ -177,54 +256,183 @@ def decompress():
         file = request.files['file']
         width = int(request.form["width"])
         height = int(request.form["height"])
-        num_frames = int(request.form.get("num_frames", 0))
+        # frame count is stored in the stream, a smaller one decodes only the start
+        num_frames = int(request.form.get("num_frames") or 0)
         
-        if num_frames <= 0:
-            return error_response("Invalid number of frames")
+        # yuv420p and nv12 skip the colour conversion back to RGB
+        output_format = request.form.get("output_format") or "rgb24"
 
-        # save uploaded file
-        filename = secure_filename(file.filename)
-        filepath = os.path.join(app.config["UPLOAD_FOLDER"], filename)
-        file.save(filepath)
+        # send the frames back as they are decoded instead of storing a file to download
+        stream = request.form.get("stream", "").lower() in ("1", "true", "on")
         
+        if num_frames < 0:
+            return error_response("Invalid number of frames")
+        if output_format not in OUTPUT_FORMATS:
+            return error_response(f"Invalid output format. Allowed formats: {', '.join(OUTPUT_FORMATS)}")
+
         # validate file content
-        if not validate_file_content(filepath, "bin"):
-            os.remove(filepath)
+        if not validate_file_content(file.stream.read(MAGIC_BYTES), "bin"):
             return error_response("Invalid file content")
+        file.stream.seek(0)
+
+        filename = secure_filename(file.filename)
+        extension = OUTPUT_EXTENSIONS[output_format]
+        decompressed_filename = f"{os.path.splitext(filename)[0]}_decompressed.{extension}"
+
+        # the same upload decompressed before is served from the cache
+        key = result_key(file, "decompress", {
+            "width": width, "height": height, "num_frames": num_frames, "output_format": output_format})
+        decompressed_path = cached_path(DECOMPRESSED_FOLDER, key, extension)
+        download_url = f"/api/download/decompressed/{key}.{extension}?name={decompressed_filename}"
+
+        hit = results.get(key)
+        if hit and stream:
+            result = hit["result"]
+            response = send_cached(hit["path"], as_attachment=True, download_name=decompressed_filename,
+                                   mimetype="application/octet-stream")
+            if response is not None:
+                response.headers.update(stream_headers(width, height, output_format,
+                                                       result["size"] // result["frame_count"]))
+                return response
+            # evicted in between, decoded again below like any other miss
+            hit = None
+        if hit:
+            return success_response(dict(hit["result"], filename=decompressed_filename, download_url=download_url))
 
         # init codec
-        encoder = VideoEncoder(width, height)
-        
-        with open(filepath, 'rb') as f:
-            compressed_data = f.read()
+        encoder = Codec(width, height)
 
-        decompressed_frames = encoder.decode_frames(compressed_data, num_frames)
-        if not decompressed_frames:
+        # decode straight from the upload, the first frame now so a bad
+        # stream is still reported as an error response
+        try:
+            decoder = encoder.open_stream(file.stream, output_format)
+            first = decoder.next_output_frame()
+        except (ValueError, zlib.error) as e:
+            raise VideoProcessingError(f"Invalid compressed stream: {e}")
+        if first is None:
             raise VideoProcessingError("Failed to decompress frames")
-        
-        # save decompressed frames
-        decompressed_filename = f"{os.path.splitext(filename)[0]}_decompressed.rgb24"
-        decompressed_path = os.path.join(DECOMPRESSED_FOLDER, decompressed_filename)
 
-        with open(decompressed_path, "wb") as f:
-            for frame in decompressed_frames:
-                f.write(frame.tobytes())
+        # the frames are saved for the cache as they are decoded, one at a time
+        frames = cached_frames(decoded_frames(decoder, first, num_frames), key, decompressed_path, output_format)
+
+        if stream:
+            # a failure part way through drops the connection, so the
+            # client sees a truncated download rather than a complete one
+            headers = stream_headers(width, height, output_format, first.nbytes)
+            headers["Content-Disposition"] = f"attachment; filename={decompressed_filename}"
+            return Response(stream_with_context(frames), mimetype="application/octet-stream", headers=headers)
+        
+        frame_count = sum(1 for _ in frames)
         
         return success_response({
             'filename': decompressed_filename,
-            'frame_count': len(decompressed_frames),
+            'frame_count': frame_count,
+            'output_format': output_format,
             'size': os.path.getsize(decompressed_path),
-            'download_url': f"/api/download/decompressed/{decompressed_filename}"
+            'download_url': download_url
         })
     except VideoProcessingError as e:
         logger.error(f"Video processing error: {str(e)}")
         return error_response(str(e))
-    finally:
-        # clean ups
-        if os.path.exists(filepath):
-            os.remove(filepath)
         
 
+@app.route('/api/jobs/<kind>', methods=['POST'])
+@validate_file_request
+def submit_job(kind):
+    """queue a compress or decompress job, its status is polled from /api/jobs/<id>"""
+    if kind not in ("compress", "decompress"):
+        return error_response("Invalid job type", 404)
+
+    file = request.files['file']
+    width = int(request.form["width"])
+    height = int(request.form["height"])
+    filename = os.path.splitext(secure_filename(file.filename))[0]
+    params = {"width": width, "height": height}
+
+    if kind == "compress":
+        expected_type, folder, extension = "rgb24", COMPRESSED_FOLDER, "bin"
+        output_name = f"{filename}_compressed.bin"
+    else:
+        params["num_frames"] = int(request.form.get("num_frames") or 0)
+        params["output_format"] = request.form.get("output_format") or "rgb24"
+        if params["num_frames"] < 0:
+            return error_response("Invalid number of frames")
+        if params["output_format"] not in OUTPUT_FORMATS:
+            return error_response(f"Invalid output format. Allowed formats: {', '.join(OUTPUT_FORMATS)}")
+        expected_type, folder, extension = "bin", DECOMPRESSED_FOLDER, OUTPUT_EXTENSIONS[params["output_format"]]
+        output_name = f"{filename}_decompressed.{extension}"
+
+    if not validate_file_content(file.stream.read(MAGIC_BYTES), expected_type):
+        return error_response("Invalid file content")
+    file.stream.seek(0)
+
+    key = result_key(file, kind, params)
+    output_path = cached_path(folder, key, extension)
+    params.update(filename=output_name, cache_key=key)
+    job_id = uuid.uuid4().hex
+
+    # the same upload processed before is done straight away, from the cache
+    hit = results.get(key)
+    if hit:
+        jobs.record_done(job_id, kind, params, output_path, dict(hit["result"], filename=output_name))
+        return success_response({
+            "job_id": job_id,
+            "status": "done",
+            "status_url": f"/api/jobs/{job_id}"
+        }, "Job done from cache")
+
+    # the queue is bounded, a full one means the workers are behind
+    if jobs.queued_count() >= MAX_QUEUED_JOBS:
+        return error_response("Too many jobs waiting, try again later", 503)
+
+    input_path = os.path.join(UPLOAD_FOLDER, job_id)
+    file.save(input_path)
+    jobs.submit(job_id, kind, params, input_path, output_path)
+
+    response = success_response({
+        "job_id": job_id,
+        "status": "queued",
+        "status_url": f"/api/jobs/{job_id}"
+    }, "Job queued")
+    return response, 202
+
+
+@app.route('/api/jobs/<job_id>')
+def job_status(job_id):
+    """status and progress of a job, and its result once done"""
+    job = jobs.get(job_id)
+    if job is None:
+        return error_response("Job not found", 404)
+
+    data = {
+        "job_id": job_id,
+        "kind": job["kind"],
+        "status": job["status"],
+        "progress": round(job["progress"] * 100, 1),
+        "frame_count": job["frame_count"]
+    }
+    if job["status"] == "queued":
+        data["position"] = job["position"]
+    elif job["status"] == "done":
+        data["result"] = dict(job["result"], download_url=f"/api/jobs/{job_id}/download")
+    elif job["status"] == "failed":
+        data["error"] = job["error"]
+    return success_response(data)
+
+
+@app.route('/api/jobs/<job_id>/download')
+def job_download(job_id):
+    job = jobs.get(job_id)
+    if job is None or job["status"] != "done":
+        return error_response("Job output not found", 404)
+
+    # the output is a result cache entry, which can be evicted once the job is done
+    response = send_cached(job["output_path"], as_attachment=True, download_name=job["result"]["filename"])
+    if response is None:
+        return error_response("Job output is no longer kept, submit the job again", 410)
+    return response
+
+
 @app.route('/api/download/<folder>/<filename>')
 def download_file(folder, filename):
     try:
@@ -232,7 +440,9 @@ def download_file(folder, filename):
             return error_response("Invalid download folder", 404)
         
         directory = COMPRESSED_FOLDER if folder == 'compressed' else DECOMPRESSED_FOLDER
-        return send_from_directory(directory, filename, as_attachment=True)
+        # outputs are kept under their cache key, name is the one to save them as
+        download_name = secure_filename(request.args.get("name", "")) or filename
+        return send_from_directory(directory, filename, as_attachment=True, download_name=download_name)
     except Exception as e:
         logger.error(f"Download error: {str(e)}")
         return error_response("Fiel not found", 404)
@@ -0,0 +1,141 @@
+import hashlib
+import json
+import logging
+import os
+import sqlite3
+import time
+from contextlib import closing
+from typing import Optional
+
+# Results of compress and decompress, keyed by a hash of the upload and
+# every setting that changes the output, so a repeated request is served
+# from disk without running the codec. The artifacts stay in compressed/
+# and decompressed/, named by their key; a SQLite table shared by the web
+# workers and the job processes records their size and last use, and the
+# least recently used ones are removed past CACHE_SIZE.
+
+CACHE_DB = "cache.db"
+CACHE_SIZE = 1024 * 1024 * 1024  # bytes of artifacts kept
+HASH_BLOCK = 1024 * 1024         # bytes of an upload hashed at a time
+CACHE_VERSION = 1                # bump when the codec's output changes
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS cache (
+    key TEXT PRIMARY KEY,
+    path TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    result TEXT NOT NULL,   -- JSON response data, without the per request names
+    last_used REAL NOT NULL
+);
+CREATE INDEX IF NOT EXISTS cache_last_used ON cache (last_used);
+"""
+
+logger = logging.getLogger(__name__)
+
+
+def upload_key(f, kind: str, params: dict) -> str:
+    """
+    Hash an upload and the settings it is processed with.
+
+    Args:
+        f: Upload opened in binary mode, seekable; it is read to the end
+            and rewound
+        kind: compress or decompress
+        params: Every setting that changes the output, including the codec
+
+    Returns:
+        Hex digest naming the result
+    """
+    digest = hashlib.sha256(json.dumps([CACHE_VERSION, kind, params], sort_keys=True).encode())
+    while True:
+        block = f.read(HASH_BLOCK)
+        if not block:
+            break
+        digest.update(block)
+    f.seek(0)
+    return digest.hexdigest()
+
+
+class ResultCache:
+    """
+    Bounded on-disk LRU cache of codec outputs. Every call opens its own
+    connection, so a cache can be used from any thread or process.
+    """
+
+    def __init__(self, path: str = CACHE_DB, max_size: int = CACHE_SIZE):
+        self.path = path
+        self.max_size = max_size
+        with closing(self.connect()) as db:
+            db.execute("PRAGMA journal_mode=WAL")
+            db.executescript(SCHEMA)
+
+    def connect(self) -> sqlite3.Connection:
+        db = sqlite3.connect(self.path, timeout=30, isolation_level=None)
+        db.row_factory = sqlite3.Row
+        return db
+
+    def get(self, key: str) -> Optional[dict]:
+        """
+        Look a result up, marking it as just used.
+
+        Returns:
+            Dict with the artifact's path and the result data, or None on
+            a miss
+        """
+        with closing(self.connect()) as db:
+            row = db.execute("SELECT path, result FROM cache WHERE key = ?", (key,)).fetchone()
+            if row is None:
+                return None
+            if not os.path.exists(row["path"]):
+                # removed behind the cache's back
+                db.execute("DELETE FROM cache WHERE key = ?", (key,))
+                return None
+            db.execute("UPDATE cache SET last_used = ? WHERE key = ?", (time.time(), key))
+        return {"path": row["path"], "result": json.loads(row["result"])}
+
+    def put(self, key: str, tmp_path: str, path: str, result: dict):
+        """
+        Add a finished result, then evict down to the size limit.
+
+        The artifact is written to a temporary file first and renamed into
+        place here, so a request for the same key never sees it half
+        written, and two requests racing to create it both leave a whole
+        one.
+
+        Args:
+            key: From upload_key()
+            tmp_path: Finished artifact, in the same directory as path
+            path: Where the artifact is kept
+            result: Response data to serve on a hit
+        """
+        os.replace(tmp_path, path)
+        with closing(self.connect()) as db:
+            db.execute("INSERT OR REPLACE INTO cache (key, path, size, result, last_used) VALUES (?, ?, ?, ?, ?)",
+                       (key, path, os.path.getsize(path), json.dumps(result), time.time()))
+        self.evict(keep=key)
+
+    def evict(self, keep: Optional[str] = None):
+        """
+        Remove least recently used artifacts until the rest fit in max_size.
+
+        Args:
+            keep: Key never removed, the result about to be served
+        """
+        with closing(self.connect()) as db:
+            db.execute("BEGIN IMMEDIATE")
+            total = db.execute("SELECT COALESCE(SUM(size), 0) FROM cache").fetchone()[0]
+            removed = []
+            for row in db.execute("SELECT key, path, size FROM cache ORDER BY last_used"):
+                if total <= self.max_size:
+                    break
+                if row["key"] == keep:
+                    continue
+                removed.append(row)
+                total -= row["size"]
+            db.executemany("DELETE FROM cache WHERE key = ?", [(row["key"],) for row in removed])
+            db.execute("COMMIT")
+
+        for row in removed:
+            logger.info(f"Evicting {row['path']} from the result cache")
+            if os.path.exists(row["path"]):
+                os.remove(row["path"])
@@ -0,0 +1,422 @@
+import argparse
+import json
+import logging
+import os
+import signal
+import sqlite3
+import time
+import zlib
+from concurrent.futures import FIRST_COMPLETED, ProcessPoolExecutor, wait
+from concurrent.futures.process import BrokenProcessPool
+from contextlib import closing
+from typing import Optional
+
+from cache import ResultCache
+from video_encoder import VideoEncoder, NativeVideoEncoder, NATIVE_AVAILABLE
+
+# Background jobs. The web workers only queue uploads in a SQLite table;
+# one runner process (`python jobs.py`, started by run.sh) claims them and
+# hands them to a pool of one process per core, so concurrent requests
+# never run more codec work at once than there are cores, however many
+# web workers there are.
+
+JOBS_DB = "jobs.db"
+MAX_QUEUED_JOBS = 100   # uploads waiting for a worker before new ones are turned away
+POLL_INTERVAL = 0.5     # seconds between the runner's looks at the queue
+PROGRESS_INTERVAL = 0.5 # seconds between progress updates of a running job
+
+# the C codec when its extension is built, the NumPy one otherwise
+Codec = NativeVideoEncoder if NATIVE_AVAILABLE else VideoEncoder
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS jobs (
+    id TEXT PRIMARY KEY,
+    kind TEXT NOT NULL,             -- compress or decompress
+    status TEXT NOT NULL,           -- queued, running, done or failed
+    params TEXT NOT NULL,           -- JSON
+    input_path TEXT NOT NULL,
+    output_path TEXT NOT NULL,
+    progress REAL NOT NULL DEFAULT 0,   -- fraction of the input read
+    frame_count INTEGER NOT NULL DEFAULT 0,
+    result TEXT,                    -- JSON, once done
+    error TEXT,                     -- once failed
+    created REAL NOT NULL,
+    started REAL,
+    finished REAL
+);
+CREATE INDEX IF NOT EXISTS jobs_status ON jobs (status, created);
+"""
+
+logger = logging.getLogger(__name__)
+
+
+class JobError(Exception):
+    """A job failure whose message is shown to the user"""
+    pass
+
+
+def default_workers() -> int:
+    """Number of cores this process may run on"""
+    if hasattr(os, "sched_getaffinity"):
+        return len(os.sched_getaffinity(0))
+    return os.cpu_count() or 1
+
+
+class JobStore:
+    """
+    Jobs table in a SQLite file, shared by the web workers, the runner and
+    the pool processes. Every call opens its own connection, so a store
+    can be used from any thread or process.
+    """
+
+    def __init__(self, path: str = JOBS_DB):
+        self.path = path
+        with closing(self.connect()) as db:
+            # readers are not blocked by the job that is writing progress
+            db.execute("PRAGMA journal_mode=WAL")
+            db.executescript(SCHEMA)
+
+    def connect(self) -> sqlite3.Connection:
+        db = sqlite3.connect(self.path, timeout=30, isolation_level=None)
+        db.row_factory = sqlite3.Row
+        return db
+
+    def submit(self, job_id: str, kind: str, params: dict, input_path: str, output_path: str):
+        """
+        Queue a job.
+
+        Args:
+            job_id: Unique id, also used to name the job's files
+            kind: compress or decompress
+            params: Settings for the job function, stored as JSON
+            input_path: Upload to read, removed when the job ends
+            output_path: Where the job's output is kept in the result cache
+        """
+        with closing(self.connect()) as db:
+            db.execute("INSERT INTO jobs (id, kind, status, params, input_path, output_path, created) "
+                       "VALUES (?, ?, 'queued', ?, ?, ?, ?)",
+                       (job_id, kind, json.dumps(params), input_path, output_path, time.time()))
+
+    def record_done(self, job_id: str, kind: str, params: dict, output_path: str, result: dict):
+        """
+        Record a job answered from the result cache, done without running.
+
+        Args:
+            job_id: Unique id
+            kind: compress or decompress
+            params: Settings of the job
+            output_path: Cached output
+            result: Response data of the cached output
+        """
+        now = time.time()
+        with closing(self.connect()) as db:
+            db.execute("INSERT INTO jobs (id, kind, status, params, input_path, output_path, progress, frame_count, "
+                       "result, created, started, finished) VALUES (?, ?, 'done', ?, '', ?, 1, ?, ?, ?, ?, ?)",
+                       (job_id, kind, json.dumps(params), output_path, result["frame_count"], json.dumps(result),
+                        now, now, now))
+
+    def queued_count(self) -> int:
+        with closing(self.connect()) as db:
+            return db.execute("SELECT COUNT(*) FROM jobs WHERE status = 'queued'").fetchone()[0]
+
+    def get(self, job_id: str) -> Optional[dict]:
+        """
+        Look a job up.
+
+        Returns:
+            The job's row, with params and result decoded and, while it is
+            queued, the number of jobs ahead of it as position; None if
+            there is no such job
+        """
+        with closing(self.connect()) as db:
+            row = db.execute("SELECT * FROM jobs WHERE id = ?", (job_id,)).fetchone()
+            if row is None:
+                return None
+            job = dict(row)
+            if job["status"] == "queued":
+                job["position"] = db.execute("SELECT COUNT(*) FROM jobs WHERE status = 'queued' AND created < ?",
+                                             (job["created"],)).fetchone()[0]
+        job["params"] = json.loads(job["params"])
+        job["result"] = json.loads(job["result"]) if job["result"] else None
+        return job
+
+    def claim(self) -> Optional[dict]:
+        """
+        Take the oldest queued job and mark it running.
+
+        Returns:
+            The job's row, or None if nothing is queued
+        """
+        with closing(self.connect()) as db:
+            # the write lock is taken before the read, so a job is only claimed once
+            db.execute("BEGIN IMMEDIATE")
+            row = db.execute("SELECT * FROM jobs WHERE status = 'queued' ORDER BY created LIMIT 1").fetchone()
+            if row is not None:
+                db.execute("UPDATE jobs SET status = 'running', started = ? WHERE id = ?", (time.time(), row["id"]))
+            db.execute("COMMIT")
+        if row is None:
+            return None
+        job = dict(row)
+        job["params"] = json.loads(job["params"])
+        return job
+
+    def set_progress(self, job_id: str, progress: float, frame_count: int):
+        with closing(self.connect()) as db:
+            db.execute("UPDATE jobs SET progress = ?, frame_count = ? WHERE id = ?", (progress, frame_count, job_id))
+
+    def finish(self, job_id: str, result: dict):
+        with closing(self.connect()) as db:
+            db.execute("UPDATE jobs SET status = 'done', progress = 1, frame_count = ?, result = ?, finished = ? "
+                       "WHERE id = ?", (result["frame_count"], json.dumps(result), time.time(), job_id))
+
+    def fail(self, job_id: str, error: str):
+        with closing(self.connect()) as db:
+            db.execute("UPDATE jobs SET status = 'failed', error = ?, finished = ? WHERE id = ?",
+                       (error, time.time(), job_id))
+
+    def fail_running(self, error: str) -> list:
+        """
+        Fail every running job, after the processes running them died.
+
+        Returns:
+            Rows of the jobs failed
+        """
+        with closing(self.connect()) as db:
+            db.execute("BEGIN IMMEDIATE")
+            rows = [dict(row) for row in db.execute("SELECT * FROM jobs WHERE status = 'running'")]
+            db.execute("UPDATE jobs SET status = 'failed', error = ?, finished = ? WHERE status = 'running'",
+                       (error, time.time()))
+            db.execute("COMMIT")
+        return rows
+
+    def requeue_running(self) -> int:
+        """
+        Queue the jobs a previous runner left running again. A job whose
+        upload is gone, removed when its process was stopped, can not run
+        again and is failed instead.
+
+        Returns:
+            Number of jobs queued again
+        """
+        with closing(self.connect()) as db:
+            db.execute("BEGIN IMMEDIATE")
+            rows = db.execute("SELECT id, input_path FROM jobs WHERE status = 'running'").fetchall()
+            lost = [row["id"] for row in rows if not os.path.exists(row["input_path"])]
+            for job_id in lost:
+                logger.warning(f"Upload of interrupted job {job_id} is gone, failing it")
+            db.executemany("UPDATE jobs SET status = 'failed', error = ?, finished = ? WHERE id = ?",
+                           [("Job was interrupted and its upload is gone", time.time(), job_id) for job_id in lost])
+            requeued = db.execute("UPDATE jobs SET status = 'queued', progress = 0, frame_count = 0, started = NULL "
+                                  "WHERE status = 'running'").rowcount
+            db.execute("COMMIT")
+        return requeued
+
+
+class ProgressReader:
+    """Binary file wrapper counting the bytes read through it"""
+
+    def __init__(self, f, report):
+        self.f = f
+        self.report = report
+        self.pos = 0
+
+    def read(self, size: int = -1) -> bytes:
+        data = self.f.read(size)
+        self.pos += len(data)
+        self.report(self.pos)
+        return data
+
+    def readinto(self, buf) -> int:
+        got = self.f.readinto(buf)
+        self.pos += got
+        self.report(self.pos)
+        return got
+
+
+def compress_job(job: dict, src, out) -> dict:
+    """
+    Encode a raw RGB24 upload.
+
+    Returns:
+        The response data of /api/compress, without the file names
+    """
+    params = job["params"]
+    encoder = Codec(params["width"], params["height"])
+    frame_count = encoder.encode_stream(src, out)
+    if frame_count == 0:
+        raise JobError("No valid frames found in input")
+
+    original_size = os.path.getsize(job["input_path"])
+    compressed_size = out.tell()
+    return {
+        "original_size": original_size,
+        "compressed_size": compressed_size,
+        "compression_ratio": f"{(1 - compressed_size / original_size) * 100:.2f}%",
+        "frame_count": frame_count
+    }
+
+
+def decompress_job(job: dict, src, out, counter: list) -> dict:
+    """
+    Decode a compressed upload.
+
+    Returns:
+        The response data of /api/decompress, without the file names
+    """
+    params = job["params"]
+    num_frames = params["num_frames"]
+    encoder = Codec(params["width"], params["height"])
+    try:
+        decoder = encoder.open_stream(src, params["output_format"])
+        while num_frames == 0 or counter[0] < num_frames:
+            frame = decoder.next_output_frame()
+            if frame is None:
+                break
+            out.write(frame.tobytes())
+            counter[0] += 1
+    except (ValueError, zlib.error) as e:
+        raise JobError(f"Invalid compressed stream: {e}")
+    if counter[0] == 0:
+        raise JobError("Failed to decompress frames")
+
+    return {
+        "frame_count": counter[0],
+        "output_format": params["output_format"],
+        "size": out.tell()
+    }
+
+
+def part_path(job: dict) -> str:
+    """File a job writes its output to, until it is moved into the result cache"""
+    return f"{job['output_path']}.{job['id']}.part"
+
+
+def run_job(db_path: str, job: dict):
+    """
+    Run one claimed job to the end, in a pool process, recording its
+    progress and outcome in the store and adding the output to the result
+    cache. The upload is removed afterwards, and the output too if the
+    job failed.
+    """
+    store = JobStore(db_path)
+    job_id = job["id"]
+    frame_size = job["params"]["width"] * job["params"]["height"] * 3
+    size = 1
+    counter = [0]  # frames decoded so far
+    last = time.monotonic()
+    done = False
+
+    def report(pos):
+        nonlocal last
+        now = time.monotonic()
+        if now - last >= PROGRESS_INTERVAL:
+            last = now
+            frames = pos // frame_size if job["kind"] == "compress" else counter[0]
+            store.set_progress(job_id, min(pos / size, 1.0), frames)
+
+    try:
+        size = max(os.path.getsize(job["input_path"]), 1)
+        with open(job["input_path"], "rb") as f, open(part_path(job), "wb") as out:
+            src = ProgressReader(f, report)
+            if job["kind"] == "compress":
+                result = compress_job(job, src, out)
+            else:
+                result = decompress_job(job, src, out, counter)
+        ResultCache().put(job["params"]["cache_key"], part_path(job), job["output_path"], result)
+        done = True
+        store.finish(job_id, dict(result, filename=job["params"]["filename"]))
+    except JobError as e:
+        logger.error(f"Job {job_id} failed: {e}")
+        store.fail(job_id, str(e))
+    except Exception as e:
+        logger.exception(f"Unexpected error in job {job_id}")
+        store.fail(job_id, "An unexpected error occured while running the job")
+    finally:
+        if os.path.exists(job["input_path"]):
+            os.remove(job["input_path"])
+        if not done and os.path.exists(part_path(job)):
+            os.remove(part_path(job))
+
+
+def init_pool_process():
+    """
+    Leave Ctrl-C and SIGTERM to the runner, which lets running jobs
+    finish. The runner's SIGTERM handler would otherwise be inherited and
+    interrupt a job, removing its upload, when the whole process group is
+    signalled.
+    """
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+    signal.signal(signal.SIGTERM, signal.SIG_IGN)
+
+
+def serve(store: JobStore, pool: ProcessPoolExecutor, workers: int):
+    """
+    Keep the pool fed with queued jobs, never more than one per worker.
+
+    Raises:
+        BrokenProcessPool: A pool process died
+    """
+    running = set()
+    while True:
+        while len(running) < workers:
+            job = store.claim()
+            if job is None:
+                break
+            logger.info(f"Starting {job['kind']} job {job['id']}")
+            running.add(pool.submit(run_job, store.path, job))
+
+        if not running:
+            time.sleep(POLL_INTERVAL)
+            continue
+        done, running = wait(running, timeout=POLL_INTERVAL, return_when=FIRST_COMPLETED)
+        for future in done:
+            # run_job records its own failures, so this only raises if its process died
+            future.result()
+
+
+def run_worker(db_path: str = JOBS_DB, workers: int = 0):
+    """
+    Run queued jobs until interrupted, then wait for the running ones
+    to finish. Jobs still queued are left for the next runner.
+
+    Args:
+        db_path: Jobs database shared with the web app
+        workers: Jobs run at once, one per core if 0
+    """
+    workers = workers or default_workers()
+    store = JobStore(db_path)
+    requeued = store.requeue_running()
+    if requeued:
+        logger.info(f"Queued {requeued} interrupted jobs again")
+    logger.info(f"Running jobs from {db_path} with {workers} workers")
+
+    while True:
+        try:
+            with ProcessPoolExecutor(max_workers=workers, initializer=init_pool_process) as pool:
+                serve(store, pool, workers)
+        except BrokenProcessPool:
+            # start over with a new pool, the jobs it was running are lost
+            for job in store.fail_running("The worker running this job died"):
+                logger.error(f"Worker died running job {job['id']}")
+                for path in (job["input_path"], part_path(job)):
+                    if os.path.exists(path):
+                        os.remove(path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run queued encode and decode jobs")
+    parser.add_argument("--db", default=JOBS_DB, help="jobs database shared with the web app")
+    parser.add_argument("--workers", type=int, default=0, help="jobs run at once (default: one per core)")
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.INFO)
+    # stop the same way on SIGTERM as on Ctrl-C, so the pool is shut down
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+    try:
+        run_worker(args.db, args.workers)
+    except KeyboardInterrupt:
+        logger.info("Stopped")
+
+
+if __name__ == "__main__":
+    main()
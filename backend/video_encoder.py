@@ -1,9 +1,75 @@
 import argparse
+import bisect
 import io
 import logging
 import numpy as np
+import struct
 import zlib
-from typing import List, Tuple
+from typing import List, NamedTuple, Optional, Tuple
+
+try:
+    import _vcodec  # native codec, built from _vcodec.c (see README)
+except ImportError:
+    _vcodec = None
+
+# Container layout, shared with the C encoder (test_c/first_iter/container.c).
+# Every field is little endian; the index and footer follow the last chunk.
+STREAM_MAGIC = b"VCDC"
+FOOTER_MAGIC = b"VEND"
+STREAM_VERSION = 1
+PIX_FMT_YUV420P = 1
+STREAM_HEADER = struct.Struct("<4sHHIIIIIB3x")  # magic, version, header size, width, height, fps num, fps den, gop, pix fmt
+CHUNK_HEADER = struct.Struct("<II")             # compressed size, frame count
+CHUNK_ENTRY = struct.Struct("<QII")             # chunk offset, first frame, frame count
+STREAM_FOOTER = struct.Struct("<QII4s")         # index offset, chunk count, frame count, magic
+
+DEFAULT_GOP_SIZE = 50
+DEFAULT_FPS = 25
+STREAM_BLOCK = 65536  # compressed bytes read at a time when streaming
+OUTPUT_FORMATS = ("rgb24", "yuv420p", "nv12")  # raw formats a decoded frame can be written as
+NATIVE_AVAILABLE = _vcodec is not None  # NativeVideoEncoder can be used
+
+
+def read_full(f, buf) -> int:
+    """
+    Fill a buffer from a file-like object, reading again after the short
+    reads of pipes and sockets.
+
+    Args:
+        f: Input opened in binary mode
+        buf: Writable buffer
+
+    Returns:
+        Number of bytes read, less than len(buf) only at the end of the input
+    """
+    view = memoryview(buf)
+    got = 0
+    while got < len(view):
+        data = f.read(len(view) - got)
+        if not data:
+            break
+        view[got:got + len(data)] = data
+        got += len(data)
+    return got
+
+
+class StreamHeader(NamedTuple):
+    """Stream parameters from the container header"""
+    version: int
+    header_size: int
+    width: int
+    height: int
+    fps: float
+    gop_size: int
+    pix_fmt: int
+
+
+class ChunkEntry(NamedTuple):
+    """Chunk index entry: where a chunk starts and which frames it holds"""
+    offset: int
+    first_frame: int
+    frames: int
+
 
 class VideoEncoder:
     """
@@ -18,10 +84,19 @@ class VideoEncoder:
     shows how to achieve ~90% compression with simple techniques.
     """
     
-    def __init__(self, width: int, height: int):
+    def __init__(self, width: int, height: int, gop_size: int = DEFAULT_GOP_SIZE, fps: float = DEFAULT_FPS):
+        if gop_size < 1:
+            raise ValueError("GOP size must be at least 1")
+
         self.width = width
         self.height = height
         self.frame_size = width * height * 3  # RGB24 format: 3 bytes per pixel
+        # a trailing odd row or column still gets its own chroma sample
+        self.chroma_width = (width + 1) // 2
+        self.chroma_height = (height + 1) // 2
+        self.yuv_frame_size = (width * height) + 2 * self.chroma_width * self.chroma_height
+        self.gop_size = gop_size
+        self.fps = fps
         
     def read_frames(self, input_data: bytes) -> List[np.ndarray]:
         """
@@ -88,8 +163,9 @@ class VideoEncoder:
         
         The encoding process:
         1. Convert each frame to YUV420
-        2. Create delta frames (except for keyframe)
-        3. Apply DEFLATE compression
+        2. Create delta frames (except for the keyframe starting each GOP)
+        3. Apply DEFLATE compression to each GOP on its own
+        4. Write the chunks into the container, followed by the chunk index
         
         Args:
             frames: List of RGB frames
@@ -98,95 +174,696 @@ class VideoEncoder:
             Compressed video data
         """
         logging.info(f"Raw size: {sum(frame.size * frame.itemsize for frame in frames)} bytes")
+        logging.info(f"YUV420P size: {self.yuv_frame_size * len(frames)} bytes ({100 * self.yuv_frame_size / self.frame_size:.2f}% original size)")
+
+        out = io.BytesIO()
+        self.write_stream(frames, out)
+
+        compressed = out.getvalue()
+        logging.info(f"DEFLATE size: {len(compressed)} bytes ({100 * len(compressed) / (self.frame_size * max(len(frames), 1)):.2f}% original size)")
         
-        # Convert frames to YUV420
-        yuv_frames = []
+        return compressed
+
+    def encode_stream(self, src, dst) -> int:
+        """
+        Encode raw RGB24 video from one file-like object straight into another.
+
+        Frames are read, converted and compressed one at a time, so only a
+        couple of frames and the compressed part of the current GOP are held
+        in memory, whatever the length of the input.
+
+        Args:
+            src: Raw RGB24 input opened in binary mode, e.g. an upload stream;
+                a trailing partial frame is ignored
+            dst: Binary output the container is written to front to back, it
+                does not need to be seekable
+
+        Returns:
+            Number of frames encoded
+        """
+        return self.write_stream(self.iter_frames(src), dst)
+
+    def iter_frames(self, src):
+        """
+        Read RGB24 frames from a file-like object one at a time.
+
+        Args:
+            src: Raw RGB24 input opened in binary mode
+
+        Yields:
+            RGB frame (height × width × 3), overwritten by the next one
+        """
+        buf = bytearray(self.frame_size)
+        frame = np.frombuffer(buf, dtype=np.uint8).reshape((self.height, self.width, 3))
+        while read_full(src, buf) == self.frame_size:
+            yield frame
+
+    def write_stream(self, frames, out) -> int:
+        """
+        Convert, delta code and compress frames into the container.
+
+        Each GOP is deflated as its frames come in, and written out as a
+        chunk once it is complete, followed at the end by the chunk index.
+
+        Args:
+            frames: Iterable of RGB frames
+            out: Binary output, written front to back
+
+        Returns:
+            Number of frames encoded
+        """
+        header = self.pack_header()
+        out.write(header)
+        offset = len(header)
+        index = []
+        count = 0
+        previous = None
+        compressor = None
+        parts = []
+
+        def write_chunk():
+            nonlocal offset
+            parts.append(compressor.flush())
+            chunk = b"".join(parts)
+            frames_in_chunk = count - count_at_key
+            index.append(ChunkEntry(offset, count_at_key, frames_in_chunk))
+            out.write(CHUNK_HEADER.pack(len(chunk), frames_in_chunk))
+            out.write(chunk)
+            offset += CHUNK_HEADER.size + len(chunk)
+            parts.clear()
+
         for frame in frames:
             Y, U, V = self.rgb_to_yuv420(frame)
             # Store in planar format (all Y, then all U, then all V)
-            yuv_frame = np.concatenate([Y.flatten(), U.flatten(), V.flatten()])
-            yuv_frames.append(yuv_frame)
-            
-        yuv_size = sum(frame.size * frame.itemsize for frame in yuv_frames)
-        logging.info(f"YUV420P size: {yuv_size} bytes ({100 * yuv_size / (self.frame_size * len(frames)):.2f}% original size)")
-        
-        # Create delta frames
-        delta_frames = []
-        for i, frame in enumerate(yuv_frames):
-            if i == 0:
-                # First frame is keyframe
-                delta_frames.append(frame)
+            yuv_frame = np.concatenate([Y.ravel(), U.ravel(), V.ravel()])
+
+            if count % self.gop_size == 0:
+                # First frame of each GOP is a keyframe, in a chunk of its own
+                if compressor is not None:
+                    write_chunk()
+                compressor = zlib.compressobj(level=9)
+                count_at_key = count
+                parts.append(compressor.compress(yuv_frame.tobytes()))
             else:
                 # Delta from previous frame
-                delta = frame - yuv_frames[i-1]
-                delta_frames.append(delta)
-        
-        # Compress using DEFLATE
-        compressed = zlib.compress(np.concatenate(delta_frames).tobytes(), level=9)
-        logging.info(f"DEFLATE size: {len(compressed)} bytes ({100 * len(compressed) / (self.frame_size * len(frames)):.2f}% original size)")
-        
-        return compressed
+                parts.append(compressor.compress((yuv_frame - previous).tobytes()))
+            previous = yuv_frame
+            count += 1
+
+        if compressor is not None:
+            write_chunk()
+
+        for entry in index:
+            out.write(CHUNK_ENTRY.pack(*entry))
+        out.write(STREAM_FOOTER.pack(offset, len(index), count, FOOTER_MAGIC))
+
+        return count
+
+    def pack_header(self) -> bytes:
+        """
+        Build the container header for this encoder's parameters.
+
+        Returns:
+            Header bytes
+        """
+        return STREAM_HEADER.pack(STREAM_MAGIC, STREAM_VERSION, STREAM_HEADER.size,
+                                  self.width, self.height, int(round(self.fps * 1000)), 1000,
+                                  self.gop_size, PIX_FMT_YUV420P)
+
+    def read_header(self, data: bytes) -> StreamHeader:
+        """
+        Parse and check the container header.
+
+        Args:
+            data: Compressed video data, or at least its first bytes
+
+        Returns:
+            Stream parameters
+
+        Raises:
+            ValueError: If the data is not a stream this encoder can decode
+        """
+        if len(data) < STREAM_HEADER.size:
+            raise ValueError("Not an encoded video stream")
+
+        magic, version, header_size, width, height, fps_num, fps_den, gop_size, pix_fmt = STREAM_HEADER.unpack_from(data)
+        if magic != STREAM_MAGIC:
+            raise ValueError("Not an encoded video stream")
+        if version != STREAM_VERSION or header_size < STREAM_HEADER.size or pix_fmt != PIX_FMT_YUV420P:
+            raise ValueError(f"Unsupported stream version {version}")
+        if (width, height) != (self.width, self.height):
+            raise ValueError(f"Stream is {width}x{height}, expected {self.width}x{self.height}")
+
+        fps = fps_num / fps_den if fps_den else 0.0
+        return StreamHeader(version, header_size, width, height, fps, gop_size, pix_fmt)
+
+    def read_index(self, data: bytes, header: StreamHeader) -> List[ChunkEntry]:
+        """
+        Find the chunks of a stream.
+
+        The index at the end of the stream lists every chunk. A stream without
+        one, e.g. cut short, is walked chunk by chunk for as far as it is intact.
+
+        Args:
+            data: Compressed video data
+            header: Parsed header of the same data
+
+        Returns:
+            Chunk index entries in frame order
+        """
+        if len(data) >= header.header_size + STREAM_FOOTER.size:
+            index_offset, chunk_count, frame_count, magic = STREAM_FOOTER.unpack_from(data, len(data) - STREAM_FOOTER.size)
+            if magic == FOOTER_MAGIC and index_offset + chunk_count * CHUNK_ENTRY.size + STREAM_FOOTER.size == len(data):
+                index = [ChunkEntry(*CHUNK_ENTRY.unpack_from(data, index_offset + i * CHUNK_ENTRY.size))
+                         for i in range(chunk_count)]
+                if sum(entry.frames for entry in index) == frame_count:
+                    return index
+
+        index = []
+        pos = header.header_size
+        first = 0
+        while pos + CHUNK_HEADER.size <= len(data):
+            size, frames = CHUNK_HEADER.unpack_from(data, pos)
+            if frames == 0 or pos + CHUNK_HEADER.size + size > len(data):
+                break
+            index.append(ChunkEntry(pos, first, frames))
+            pos += CHUNK_HEADER.size + size
+            first += frames
+
+        return index
+
+    def read_file_index(self, f) -> Tuple[StreamHeader, List[ChunkEntry]]:
+        """
+        Read the header and chunk index of an encoded file.
+
+        Only the header, footer and index are read, however long the video.
+
+        Args:
+            f: Encoded file, opened in binary mode and seekable
+
+        Returns:
+            Tuple of (header, chunk index entries in frame order)
 
-    def decode_frames(self, compressed_data: bytes, num_frames: int) -> List[np.ndarray]:
+        Raises:
+            ValueError: If the file is not a stream with an index
+        """
+        f.seek(0)
+        header = self.read_header(f.read(STREAM_HEADER.size))
+
+        size = f.seek(0, io.SEEK_END)
+        if size < header.header_size + STREAM_FOOTER.size:
+            raise ValueError("Stream has no chunk index")
+        f.seek(size - STREAM_FOOTER.size)
+        index_offset, chunk_count, frame_count, magic = STREAM_FOOTER.unpack(f.read(STREAM_FOOTER.size))
+        if magic != FOOTER_MAGIC or index_offset + chunk_count * CHUNK_ENTRY.size + STREAM_FOOTER.size != size:
+            raise ValueError("Stream has no chunk index")
+
+        f.seek(index_offset)
+        entries = f.read(chunk_count * CHUNK_ENTRY.size)
+        index = [ChunkEntry(*CHUNK_ENTRY.unpack_from(entries, i * CHUNK_ENTRY.size)) for i in range(chunk_count)]
+        if sum(entry.frames for entry in index) != frame_count:
+            raise ValueError("Invalid chunk index")
+
+        return header, index
+
+    def decode_chunk(self, chunk: bytes, frames: int) -> List[np.ndarray]:
+        """
+        Inflate the start of one chunk and reconstruct its frames from the deltas.
+
+        Inflating stops once the frames asked for are out, so a seek to the
+        start of a GOP does not pay for the rest of it.
+
+        Args:
+            chunk: Compressed chunk, without its chunk header
+            frames: Number of frames to decode from the start of the chunk
+
+        Returns:
+            YUV420 frames of the chunk
+        """
+        inflater = zlib.decompressobj()
+        decompressed = np.frombuffer(inflater.decompress(chunk, frames * self.yuv_frame_size), dtype=np.uint8)
+        frames = len(decompressed) // self.yuv_frame_size
+
+        yuv_frames = [decompressed[i * self.yuv_frame_size:(i + 1) * self.yuv_frame_size] for i in range(frames)]
+        for i in range(1, len(yuv_frames)):
+            yuv_frames[i] = yuv_frames[i] + yuv_frames[i-1]
+
+        return yuv_frames
+
+    def decode_frames(self, compressed_data: bytes, num_frames: Optional[int] = None) -> List[np.ndarray]:
         """
         Decode compressed video data back to RGB frames.
         
         The decoding process:
-        1. Decompress DEFLATE data
+        1. Decompress DEFLATE data, one chunk at a time
         2. Reconstruct frames from deltas
         3. Convert YUV420 back to RGB
         
         Args:
             compressed_data: Compressed video data
-            num_frames: Number of frames to decode
+            num_frames: Number of frames to decode, all frames if None
             
         Returns:
             List of RGB frames
         """
-        # Decompress DEFLATE
-        decompressed = np.frombuffer(zlib.decompress(compressed_data), dtype=np.uint8)
-        
-        # Calculate size of each YUV frame
-        yuv_frame_size = (self.width * self.height) + (self.width * self.height // 2)
+        header = self.read_header(compressed_data)
+        data = memoryview(compressed_data)
+
+        # Decompress and reconstruct only the chunks needed
+        frames = []
+        for entry in self.read_index(compressed_data, header):
+            if num_frames is not None and len(frames) >= num_frames:
+                break
+            size, count = CHUNK_HEADER.unpack_from(data, entry.offset)
+            start = entry.offset + CHUNK_HEADER.size
+            if num_frames is not None:
+                count = min(count, num_frames - len(frames))
+            frames.extend(self.decode_chunk(data[start:start + size], count))
         
-        # Split into frames
+        # Convert back to RGB
+        return [self.yuv420_to_rgb(frame) for frame in frames]
+
+    def decode_range(self, f, first_frame: int, count: int) -> List[np.ndarray]:
+        """
+        Decode a run of frames from an encoded file.
+
+        The chunk index gives the keyframe at or before first_frame, so only the
+        chunks covering the range are read and inflated, and only the frames
+        up to the last one asked for are reconstructed.
+
+        Args:
+            f: Encoded file, opened in binary mode and seekable
+            first_frame: First frame to decode
+            count: Number of frames to decode
+
+        Returns:
+            List of RGB frames
+
+        Raises:
+            ValueError: If the range is not within the stream
+        """
+        header, index = self.read_file_index(f)
+        frame_count = sum(entry.frames for entry in index)
+        if first_frame < 0 or count <= 0 or first_frame + count > frame_count:
+            raise ValueError(f"Frames {first_frame}..{first_frame + count - 1} out of range, stream has {frame_count}")
+
+        # Start from the chunk holding first_frame
+        starts = [entry.first_frame for entry in index]
+        chunk = bisect.bisect_right(starts, first_frame) - 1
+        last = first_frame + count
+
         frames = []
-        for i in range(num_frames):
-            start = i * yuv_frame_size
-            end = start + yuv_frame_size
-            frames.append(decompressed[start:end])
+        for entry in index[chunk:]:
+            if entry.first_frame >= last:
+                break
+            f.seek(entry.offset)
+            size, frames_in_chunk = CHUNK_HEADER.unpack(f.read(CHUNK_HEADER.size))
+            needed = min(frames_in_chunk, last - entry.first_frame)
+            decoded = self.decode_chunk(f.read(size), needed)
+            if len(decoded) != needed:
+                raise ValueError(f"Chunk at frame {entry.first_frame} is damaged")
+            skip = max(first_frame - entry.first_frame, 0)
+            frames.extend(decoded[skip:])
+
+        return [self.yuv420_to_rgb(frame) for frame in frames]
+
+    def open_stream(self, f, output_format: str = "rgb24") -> "StreamDecoder":
+        """
+        Start decoding an encoded file one frame at a time.
+
+        Args:
+            f: Encoded file or pipe, opened in binary mode
+            output_format: One of OUTPUT_FORMATS, for next_output_frame()
+
+        Returns:
+            Decoder whose next_frame() returns the frames in order
+        """
+        return StreamDecoder(self, f, output_format)
+
+    def yuv420_to_nv12(self, frame: np.ndarray) -> np.ndarray:
+        """
+        Convert a YUV420 frame to NV12, the Y plane followed by interleaved U and V.
+
+        Args:
+            frame: Planar YUV420 frame data
+
+        Returns:
+            NV12 frame data, the same size as the input
+        """
+        y_size = self.width * self.height
+        c_size = self.chroma_width * self.chroma_height
+        nv12 = np.empty_like(frame)
+        nv12[:y_size] = frame[:y_size]
+        nv12[y_size::2] = frame[y_size:y_size + c_size]
+        nv12[y_size + 1::2] = frame[y_size + c_size:]
+        return nv12
+
+    def convert_output(self, frame: np.ndarray, output_format: str) -> np.ndarray:
+        """
+        Convert a decoded YUV420 frame to one of OUTPUT_FORMATS.
+
+        yuv420p is the decoder's own layout, so it is returned as is with
+        no colour conversion at all.
+
+        Args:
+            frame: Planar YUV420 frame data
+            output_format: One of OUTPUT_FORMATS
+
+        Returns:
+            Frame data in the requested format
+        """
+        if output_format == "yuv420p":
+            return frame
+        if output_format == "nv12":
+            return self.yuv420_to_nv12(frame)
+        if output_format == "rgb24":
+            return self.yuv420_to_rgb(frame)
+        raise ValueError(f"Unknown output format {output_format}")
+
+    def yuv420_to_rgb(self, frame: np.ndarray) -> np.ndarray:
+        """
+        Convert a YUV420 frame back to RGB.
+
+        Args:
+            frame: Planar YUV420 frame data
+
+        Returns:
+            RGB frame (height × width × 3)
+        """
+        # Split into Y, U, V components
+        y_size = self.width * self.height
+        c_size = self.chroma_width * self.chroma_height
+        Y = frame[:y_size].reshape(self.height, self.width)
+        U = frame[y_size:y_size + c_size].reshape(self.chroma_height, self.chroma_width)
+        V = frame[y_size + c_size:].reshape(self.chroma_height, self.chroma_width)
         
-        # Reconstruct from deltas
-        for i in range(1, len(frames)):
-            frames[i] = frames[i] + frames[i-1]
+        # Upsample U and V, dropping the extra row or column of an odd size
+        U = np.repeat(np.repeat(U, 2, axis=0), 2, axis=1)[:self.height, :self.width]
+        V = np.repeat(np.repeat(V, 2, axis=0), 2, axis=1)[:self.height, :self.width]
         
-        # Convert back to RGB
-        rgb_frames = []
-        for frame in frames:
-            # Split into Y, U, V components
-            Y = frame[:self.width * self.height].reshape(self.height, self.width)
-            U = frame[self.width * self.height:self.width * self.height + self.width * self.height // 4].reshape(self.height // 2, self.width // 2)
-            V = frame[self.width * self.height + self.width * self.height // 4:].reshape(self.height // 2, self.width // 2)
-            
-            # Upsample U and V
-            U = np.repeat(np.repeat(U, 2, axis=0), 2, axis=1)
-            V = np.repeat(np.repeat(V, 2, axis=0), 2, axis=1)
-            
-            # Convert to float for calculations
-            Y = Y.astype(np.float32)
-            U = U.astype(np.float32) - 128
-            V = V.astype(np.float32) - 128
-            
-            # YUV to RGB conversion
-            R = np.clip(Y + 1.402 * V, 0, 255).astype(np.uint8)
-            G = np.clip(Y - 0.344 * U - 0.714 * V, 0, 255).astype(np.uint8)
-            B = np.clip(Y + 1.772 * U, 0, 255).astype(np.uint8)
-            
-            # Stack RGB channels
-            rgb_frame = np.stack([R, G, B], axis=2)
-            rgb_frames.append(rgb_frame)
-            
-        return rgb_frames
+        # Convert to float for calculations
+        Y = Y.astype(np.float32)
+        U = U.astype(np.float32) - 128
+        V = V.astype(np.float32) - 128
+        
+        # YUV to RGB conversion
+        R = np.clip(Y + 1.402 * V, 0, 255).astype(np.uint8)
+        G = np.clip(Y - 0.344 * U - 0.714 * V, 0, 255).astype(np.uint8)
+        B = np.clip(Y + 1.772 * U, 0, 255).astype(np.uint8)
+        
+        # Stack RGB channels
+        return np.stack([R, G, B], axis=2)
+
+class StreamDecoder:
+    """
+    Pull-style decoder that reads an encoded stream front to back.
+
+    Only one inflate state and one reference frame are kept, so memory use
+    does not depend on the length of the video and each frame is out as
+    soon as its part of the stream has been read. The input does not need
+    to be seekable.
+    """
+
+    def __init__(self, encoder: VideoEncoder, f, output_format: str = "rgb24"):
+        if output_format not in OUTPUT_FORMATS:
+            raise ValueError(f"Unknown output format {output_format}")
+        self.encoder = encoder
+        self.f = f
+        self.output_format = output_format
+        self.header = encoder.read_header(f.read(STREAM_HEADER.size))
+        # fields a later version adds to the header
+        f.read(self.header.header_size - STREAM_HEADER.size)
+
+        self.inflater = None
+        self.chunk_bytes = 0   # compressed bytes of the current chunk not read yet
+        self.frames_left = 0   # frames of the current chunk not decoded yet
+        self.reference = None
+        self.frame_count = 0
+
+    def next_chunk(self) -> bool:
+        """
+        Skip what is left of the current chunk and start the next one.
+
+        Returns:
+            False at the end of the chunks
+        """
+        # the zlib trailer is not needed once all frames are out
+        while self.chunk_bytes > 0:
+            skipped = len(self.f.read(min(self.chunk_bytes, STREAM_BLOCK)))
+            if skipped == 0:
+                raise ValueError("Stream ends inside a chunk")
+            self.chunk_bytes -= skipped
+
+        chunk_header = self.f.read(CHUNK_HEADER.size)
+        if len(chunk_header) < CHUNK_HEADER.size:
+            return False
+        # the chunk index reads as a chunk with no frames
+        size, frames = CHUNK_HEADER.unpack(chunk_header)
+        if frames == 0:
+            return False
+
+        self.inflater = zlib.decompressobj()
+        self.chunk_bytes = size
+        self.frames_left = frames
+        return True
+
+    def next_yuv_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame, without converting it to RGB.
+
+        Returns:
+            YUV420 frame, overwritten by the next call, or None at the end
+        """
+        key = False
+        if self.frames_left == 0:
+            if not self.next_chunk():
+                return None
+            key = True
+
+        need = self.encoder.yuv_frame_size
+        frame = bytearray()
+        while len(frame) < need:
+            data = self.inflater.unconsumed_tail
+            if not data:
+                data = self.f.read(min(self.chunk_bytes, STREAM_BLOCK))
+                if not data:
+                    raise ValueError(f"Frame {self.frame_count} is truncated")
+                self.chunk_bytes -= len(data)
+            frame += self.inflater.decompress(data, need - len(frame))
+
+        frame = np.frombuffer(frame, dtype=np.uint8)
+        if key:
+            self.reference = frame.copy()
+        else:
+            np.add(self.reference, frame, out=self.reference)
+
+        self.frames_left -= 1
+        self.frame_count += 1
+        return self.reference
+
+    def next_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame.
+
+        Returns:
+            RGB frame (height × width × 3), or None at the end of the stream
+        """
+        frame = self.next_yuv_frame()
+        return None if frame is None else self.encoder.yuv420_to_rgb(frame)
+
+    def next_output_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame in the output format the stream was opened with.
+
+        Returns:
+            Frame data, or None at the end of the stream
+        """
+        frame = self.next_yuv_frame()
+        return None if frame is None else self.encoder.convert_output(frame, self.output_format)
+
+    def __iter__(self):
+        while True:
+            frame = self.next_frame()
+            if frame is None:
+                return
+            yield frame
+
+
+class NativeVideoEncoder(VideoEncoder):
+    """
+    VideoEncoder running on the C codec through the _vcodec extension.
+
+    Frames are handed to C in place, without the float32 copies, lists and
+    concatenation of the NumPy path, and the GIL is released while they are
+    encoded or decoded, so other request threads keep running. Colour
+    conversion is the C fixed point one, so its streams can differ from
+    VideoEncoder's by rounding, but each decodes the other's.
+    """
+
+    def __init__(self, width: int, height: int, gop_size: int = DEFAULT_GOP_SIZE, fps: float = DEFAULT_FPS,
+                 threads: int = 1):
+        if _vcodec is None:
+            raise ImportError("The _vcodec extension is not built")
+        super().__init__(width, height, gop_size, fps)
+        self.threads = threads
+
+    def read_frames(self, input_data: bytes) -> np.ndarray:
+        """
+        View raw RGB24 input as frames, without copying it.
+
+        Args:
+            input_data: Raw video data in RGB24 format
+
+        Returns:
+            Array of frames (count × height × width × 3), a trailing partial frame is dropped
+        """
+        count = len(input_data) // self.frame_size
+        frames = np.frombuffer(input_data, dtype=np.uint8, count=count * self.frame_size)
+        logging.info(f"Frame count: {count}")
+        return frames.reshape((count, self.height, self.width, 3))
+
+    def encode_frames(self, frames) -> bytes:
+        """
+        Encode video frames with the C encoder.
+
+        Args:
+            frames: Array of RGB frames from read_frames(), or a list of them
+
+        Returns:
+            Compressed video data
+        """
+        encoder = _vcodec.Encoder(self.width, self.height, self.gop_size, self.fps, self.threads)
+        if isinstance(frames, np.ndarray):
+            parts = [encoder.encode(np.ascontiguousarray(frames, dtype=np.uint8))]
+        else:
+            parts = [encoder.encode(np.ascontiguousarray(frame, dtype=np.uint8)) for frame in frames]
+        parts.append(encoder.flush())
+
+        compressed = b"".join(parts)
+        logging.info(f"DEFLATE size: {len(compressed)} bytes ({100 * len(compressed) / (self.frame_size * max(len(frames), 1)):.2f}% original size)")
+        return compressed
+
+    def encode_stream(self, src, dst) -> int:
+        """
+        Encode raw RGB24 video from one file-like object straight into another
+        with the C encoder.
+
+        Args:
+            src: Raw RGB24 input opened in binary mode, e.g. an upload stream;
+                a trailing partial frame is ignored
+            dst: Binary output the container is written to front to back
+
+        Returns:
+            Number of frames encoded
+        """
+        encoder = _vcodec.Encoder(self.width, self.height, self.gop_size, self.fps, self.threads)
+        frame = bytearray(self.frame_size)
+        while read_full(src, frame) == self.frame_size:
+            dst.write(encoder.encode(frame))
+        dst.write(encoder.flush())
+        return encoder.frame_count
+
+    def decode_frames(self, compressed_data: bytes, num_frames: Optional[int] = None) -> List[np.ndarray]:
+        """
+        Decode compressed video data back to RGB frames with the C decoder.
+
+        Args:
+            compressed_data: Compressed video data
+            num_frames: Number of frames to decode, all frames if None
+
+        Returns:
+            List of RGB frames
+        """
+        frames = []
+        for frame in self.open_stream(io.BytesIO(compressed_data)):
+            if num_frames is not None and len(frames) >= num_frames:
+                break
+            frames.append(frame)
+        return frames
+
+    def open_stream(self, f, output_format: str = "rgb24") -> "NativeStreamDecoder":
+        """
+        Start decoding an encoded file one frame at a time with the C decoder.
+
+        Args:
+            f: Encoded file or pipe, opened in binary mode
+            output_format: One of OUTPUT_FORMATS, for next_output_frame()
+
+        Returns:
+            Decoder with the methods of StreamDecoder
+        """
+        return NativeStreamDecoder(self, f, output_format)
+
+
+class NativeStreamDecoder:
+    """
+    StreamDecoder running on the C decoder.
+
+    rgb24 is converted in C while the frame is decoded, nv12 is interleaved
+    from yuv420p, so only the format the stream was opened with is cheap.
+    """
+
+    def __init__(self, encoder: NativeVideoEncoder, f, output_format: str = "rgb24"):
+        if output_format not in OUTPUT_FORMATS:
+            raise ValueError(f"Unknown output format {output_format}")
+        self.encoder = encoder
+        self.output_format = output_format
+        self.native_format = "rgb24" if output_format == "rgb24" else "yuv420p"
+        self.decoder = _vcodec.Decoder(f, self.native_format, encoder.threads)
+        if (self.decoder.width, self.decoder.height) != (encoder.width, encoder.height):
+            raise ValueError(f"Stream is {self.decoder.width}x{self.decoder.height}, "
+                             f"expected {encoder.width}x{encoder.height}")
+        self.frame = np.empty(self.decoder.frame_bytes, dtype=np.uint8)
+        self.frame_count = 0
+
+    def _decode(self, frame: np.ndarray) -> bool:
+        if not self.decoder.decode_into(frame):
+            return False
+        self.frame_count += 1
+        return True
+
+    def next_yuv_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame, without converting it to RGB.
+
+        Returns:
+            YUV420 frame, overwritten by the next call, or None at the end
+        """
+        if self.native_format != "yuv420p":
+            raise ValueError("Stream was opened for rgb24 output")
+        return self.frame if self._decode(self.frame) else None
+
+    def next_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame.
+
+        Returns:
+            RGB frame (height × width × 3), or None at the end of the stream
+        """
+        if self.native_format == "yuv420p":
+            frame = self.next_yuv_frame()
+            return None if frame is None else self.encoder.yuv420_to_rgb(frame)
+        frame = np.empty((self.encoder.height, self.encoder.width, 3), dtype=np.uint8)
+        return frame if self._decode(frame) else None
+
+    def next_output_frame(self) -> Optional[np.ndarray]:
+        """
+        Decode the next frame in the output format the stream was opened with.
+
+        Returns:
+            Frame data, overwritten by the next call, or None at the end of the stream
+        """
+        if self.native_format == "rgb24":
+            return self.frame if self._decode(self.frame) else None
+        frame = self.next_yuv_frame()
+        return None if frame is None else self.encoder.convert_output(frame, self.output_format)
+
+    def __iter__(self):
+        while True:
+            frame = self.next_frame()
+            if frame is None:
+                return
+            yield frame
 
 def main():
     """Main function to demonstrate the video encoder/decoder."""
@@ -13,7 +13,9 @@ const VideoCodecApp = () => {
   const [formData, setFormData] = useState({
     width: '',
     height: '',
-    num_frames: ''
+    num_frames: '',
+    output_format: 'rgb24',
+    stream: false
   });
 
   const handleFileChange = (e) => {
@@ -30,13 +32,40 @@ const VideoCodecApp = () => {
   };
 
   const handleInputChange = (e) => {
-    const { name, value } = e.target;
+    const { name, value, type, checked } = e.target;
     setFormData(prev => ({
       ...prev,
-      [name]: value
+      [name]: type === 'checkbox' ? checked : value
     }));
   };
 
+  // Poll a job until it finishes, showing its progress, and return its result
+  const waitForJob = async (statusUrl) => {
+    for (;;) {
+      const response = await fetch(statusUrl);
+      const data = await response.json();
+      if (!data.success) {
+        throw new Error(data.error || 'Job not found');
+      }
+
+      const job = data.data;
+      if (job.status === 'done') {
+        return job.result;
+      }
+      if (job.status === 'failed') {
+        throw new Error(job.error || 'Processing failed');
+      }
+
+      setNotification({
+        type: 'info',
+        message: job.status === 'queued'
+          ? `Waiting for a worker, ${job.position} jobs ahead`
+          : `Processing... ${job.progress}% (${job.frame_count} frames)`
+      });
+      await new Promise(resolve => setTimeout(resolve, 500));
+    }
+  };
+
   const processVideo = async (e) => {
     e.preventDefault();
     if (!fileDetails?.file) {
@@ -56,10 +85,14 @@ const VideoCodecApp = () => {
     submitData.append('height', formData.height);
     if (activeTab === 'decompress') {
       submitData.append('num_frames', formData.num_frames);
+      submitData.append('output_format', formData.output_format);
+      submitData.append('stream', formData.stream);
     }
 
     try {
-      const response = await fetch(`/api/${activeTab}`, {
+      // streaming needs the request to do the work, everything else is queued as a job
+      const streaming = activeTab === 'decompress' && formData.stream;
+      const response = await fetch(streaming ? '/api/decompress' : `/api/jobs/${activeTab}`, {
         method: "POST",
         body: submitData
       });
@@ -69,38 +102,59 @@ const VideoCodecApp = () => {
         console.error("Server error:", errorText);
         throw new Error(errorText || "Server request failed");
       }
-      
+
+      // A streamed decompression is the video itself, not JSON
+      if (streaming) {
+        const disposition = response.headers.get('Content-Disposition') || '';
+        const filename = disposition.split('filename=')[1] || 'decompressed';
+        const blob = await response.blob();
+        const frameSize = Number(response.headers.get('X-Frame-Size'));
+
+        const url = URL.createObjectURL(blob);
+        const link = document.createElement('a');
+        link.href = url;
+        link.download = filename;
+        link.click();
+        URL.revokeObjectURL(url);
+
+        setNotification({
+          type: 'success',
+          message: `Decompression complete! ${frameSize ? blob.size / frameSize : 0} frames processed`
+        });
+        return;
+      }
+
       const responseText = await response.text()
       //const data = await response.json();
       console.log('Raw response: ', responseText);
 
+      let data;
       try {
-        const data = JSON.parse(responseText)
-
-        if (data.success) {
-          // show success worth stats
-          let successMessage = activeTab === 'compress'
-          ? `Compression complete! Ratio; ${data.data.compression_ratio}`
-          : `Decompression complete! ${data.data.frame_count} frames processed`;
-
-          setNotification({
-            type: 'success',
-            message: successMessage,
-            data: data.data
-          });
-
-          // Trigger download
-          window.location.href = data.data.download_url;
-        } else {
-          throw new Error(data.error || 'Processing failed');
-        }
+        data = JSON.parse(responseText)
       } catch (jsonError) {
         console.error("JSON parsing Error: ", jsonError)
-        setNotification({
-          type: 'error',
-          message: "Failed to parse server response"
-        })
+        throw new Error("Failed to parse server response");
       }
+      if (!data.success) {
+        throw new Error(data.error || 'Processing failed');
+      }
+
+      // the work runs in the background, wait for the job to finish
+      const result = await waitForJob(data.data.status_url);
+
+      // show success worth stats
+      let successMessage = activeTab === 'compress'
+      ? `Compression complete! Ratio; ${result.compression_ratio}`
+      : `Decompression complete! ${result.frame_count} frames processed`;
+
+      setNotification({
+        type: 'success',
+        message: successMessage,
+        data: result
+      });
+
+      // Trigger download
+      window.location.href = result.download_url;
     } catch (error) {
       setNotification({
         type: 'error',
@@ -117,7 +171,9 @@ const VideoCodecApp = () => {
     setFormData({
       width: '',
       height: '',
-      num_frames: ''
+      num_frames: '',
+      output_format: 'rgb24',
+      stream: false
     });
     // reset failed
     const fileInput = document.getElementById('file-upload');
@@ -251,20 +307,50 @@ const VideoCodecApp = () => {
                 {activeTab === 'decompress' && (
                   <div className="md:col-span-2">
                     <label className="block text-sm font-medium text-gray-700">
-                      Number of Frames
+                      Number of Frames (optional)
                     </label>
                     <input
                       type="number"
                       name="num_frames"
                       value={formData.num_frames}
                       onChange={handleInputChange}
-                      required
                       min="1"
                       className="block w-full mt-1 border-gray-300 rounded-md shadow-sm focus:border-blue-500 focus:ring-blue-500"
-                      placeholder="e.g., 120"
+                      placeholder="all frames"
                     />
                   </div>
                 )}
+                {activeTab === 'decompress' && (
+                  <div className="md:col-span-2">
+                    <label className="block text-sm font-medium text-gray-700">
+                      Output Format
+                    </label>
+                    <select
+                      name="output_format"
+                      value={formData.output_format}
+                      onChange={handleInputChange}
+                      className="block w-full mt-1 border-gray-300 rounded-md shadow-sm focus:border-blue-500 focus:ring-blue-500"
+                    >
+                      <option value="rgb24">rgb24</option>
+                      <option value="yuv420p">yuv420p (no colour conversion)</option>
+                      <option value="nv12">nv12</option>
+                    </select>
+                  </div>
+                )}
+                {activeTab === 'decompress' && (
+                  <div className="md:col-span-2">
+                    <label className="flex items-center text-sm font-medium text-gray-700">
+                      <input
+                        type="checkbox"
+                        name="stream"
+                        checked={formData.stream}
+                        onChange={handleInputChange}
+                        className="mr-2 border-gray-300 rounded focus:ring-blue-500"
+                      />
+                      Stream the video back as it is decoded
+                    </label>
+                  </div>
+                )}
               </div>
 
               {/* Action Buttons */}
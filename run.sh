@@ -4,10 +4,14 @@ cd backend || exit
 python app.py &
 P1=$!
 
+# start the job runner, one codec process per core
+python jobs.py &
+P3=$!
+
 # start front end server
 cd ../frontend || exit
 npm run preview &
 P2=$!
 
-# wait for both processses
-wait $P1 $P2
+# wait for all processses
+wait $P1 $P2 $P3
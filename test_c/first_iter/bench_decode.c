@@ -0,0 +1,421 @@
+// bench_decode.c
+/*
+ * Check and benchmark of the parallel chunk decoder, decode_frames(),
+ * and of decode_range() and stream_decoder_seek() against the serial
+ * stream decoder. Build with:
+ *   gcc -O2 -pthread bench_decode.c $(ls *.c | grep -v -E '^(main|vid_codec|vid_decode|bench_.*)\.c$') -lz -lm -o bench_decode
+ * and run it on a stream written by vid_codec.
+ */
+#include "codec.h"
+#include <time.h>
+
+static const int thread_counts[] = {1, 2, 3, 4};
+/* frames per decode_range() call when timing a run decoded in batches */
+#define RANGE_BATCH 16
+
+/**
+ * now - Monotonic time in seconds
+ *
+ * Return: Current time
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * load_file - Read a whole file into memory
+ * @filename: File to read
+ * @size: Pointer to store the file size
+ *
+ * Return: File contents, or NULL on failure
+ */
+static unsigned char *load_file(const char *filename, size_t *size)
+{
+    unsigned char *data = NULL;
+    FILE *fp;
+    long len;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+        data = malloc(len);
+        if (data && fread(data, 1, len, fp) != (size_t)len) {
+            free(data);
+            data = NULL;
+        }
+        *size = len;
+    }
+    fclose(fp);
+
+    return data;
+}
+
+/**
+ * decode_serial - Decode a whole stream with the serial decoder
+ * @ctx: Unsized encoder context, set up from the stream header
+ * @filename: Encoded file
+ * @frame_count: Pointer to store the number of frames decoded
+ *
+ * Return: All frames back to back, or NULL on failure
+ */
+static unsigned char *decode_serial(encoder_context *ctx, const char *filename, int *frame_count)
+{
+    stream_decoder dec;
+    const unsigned char *yuv;
+    unsigned char *frames = NULL, *tmp;
+    FILE *fp;
+
+    *frame_count = 0;
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return NULL;
+    if (stream_decoder_init(&dec, ctx, fp) == 0) {
+        while ((yuv = decoder_next_frame(&dec))) {
+            tmp = realloc(frames, (*frame_count + 1) * ctx->yuv_size);
+            if (!tmp) {
+                dec.error = 1;
+                break;
+            }
+            frames = tmp;
+            memcpy(frames + *frame_count * ctx->yuv_size, yuv, ctx->yuv_size);
+            (*frame_count)++;
+        }
+    }
+    if (dec.error) {
+        free(frames);
+        frames = NULL;
+    }
+    stream_decoder_free(&dec);
+    fclose(fp);
+
+    return frames;
+}
+
+/**
+ * check_frames - Decode a run of frames in parallel and compare them
+ * @ctx: Encoder context with its threads set
+ * @data: Whole stream
+ * @size: Size of the stream
+ * @ref: Frames from the serial decoder
+ * @first: First frame to decode
+ * @count: Number of frames to decode
+ *
+ * Return: 0 if every frame matched, 1 otherwise
+ */
+static int check_frames(encoder_context *ctx, unsigned char *data, size_t size, const unsigned char *ref, int first,
+                        int count)
+{
+    video_frame *frames = calloc(count, sizeof(*frames));
+    int failed = 0;
+
+    /* frames decode_frames() did not get to are left NULL */
+    if (!frames || decode_frames(ctx, data, size, first, frames, count) != 0)
+        failed = 1;
+    for (int i = 0; frames && i < count; i++) {
+        if (!failed && memcmp(frames[i].data, ref + (size_t)(first + i) * ctx->yuv_size, ctx->yuv_size) != 0)
+            failed = 1;
+        arena_free(&ctx->yuv_arena, frames[i].data);
+    }
+    free(frames);
+
+    if (failed)
+        printf("  frames %d..%d with %d threads: MISMATCH\n", first, first + count - 1, ctx->threads);
+
+    return failed;
+}
+
+/**
+ * check_range - Decode a run of frames with decode_range() and compare them
+ * @ctx: Encoder context
+ * @fp: Encoded file
+ * @ref: Frames from the serial decoder
+ * @first: First frame to decode
+ * @count: Number of frames to decode
+ *
+ * Return: 0 if every frame matched, 1 otherwise
+ */
+static int check_range(encoder_context *ctx, FILE *fp, const unsigned char *ref, int first, int count)
+{
+    video_frame *frames = malloc(count * sizeof(*frames));
+    int failed = 0;
+
+    if (!frames || decode_range(ctx, fp, first, count, frames) != 0) {
+        free(frames);
+        printf("  range %d..%d: FAILED\n", first, first + count - 1);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!failed && memcmp(frames[i].data, ref + (size_t)(first + i) * ctx->yuv_size, ctx->yuv_size) != 0)
+            failed = 1;
+        arena_free(&ctx->yuv_arena, frames[i].data);
+    }
+    free(frames);
+
+    if (failed)
+        printf("  range %d..%d: MISMATCH\n", first, first + count - 1);
+
+    return failed;
+}
+
+/**
+ * check_ranges - Compare decode_range() with the serial decoder
+ * @filename: Encoded file
+ * @ref: Frames from the serial decoder
+ * @frame_count: Number of frames in the stream
+ * @secs: Pointer to store the time to decode the last frame on its own
+ *
+ * Runs start on, just before and just after every key frame, and ranges
+ * asking for frames past the end or before the start must be refused.
+ *
+ * Return: 0 if every frame matched, 1 otherwise
+ */
+static int check_ranges(const char *filename, const unsigned char *ref, int frame_count, double *secs)
+{
+    encoder_context ctx;
+    stream_header hdr;
+    video_frame spare[2];
+    unsigned char buf[STREAM_HEADER_SIZE];
+    double start;
+    int failed = 0;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if (!fp || fread(buf, sizeof(buf), 1, fp) != 1 || parse_stream_header(buf, &hdr) != 0) {
+        if (fp)
+            fclose(fp);
+        return 1;
+    }
+    memset(&ctx, 0, sizeof(ctx));
+    init_encoder(&ctx, hdr.width, hdr.height);
+
+    for (int first = 0; first < frame_count; first += hdr.gop_size) {
+        int starts[] = {first - 1, first, first + 1};
+
+        for (int s = 0; s < 3; s++) {
+            int counts[] = {1, hdr.gop_size, 2 * hdr.gop_size + 1};
+
+            if (starts[s] < 0 || starts[s] >= frame_count)
+                continue;
+            for (int c = 0; c < 3; c++) {
+                int count = counts[c] < frame_count - starts[s] ? counts[c] : frame_count - starts[s];
+
+                failed |= check_range(&ctx, fp, ref, starts[s], count);
+            }
+        }
+    }
+
+    start = now();
+    failed |= check_range(&ctx, fp, ref, frame_count - 1, 1);
+    *secs = now() - start;
+
+    if (decode_range(&ctx, fp, frame_count - 1, 2, spare) == 0 || decode_range(&ctx, fp, -1, 1, spare) == 0) {
+        printf("  range outside the stream: not refused\n");
+        failed = 1;
+    }
+
+    free_encoder(&ctx);
+    fclose(fp);
+
+    return failed;
+}
+
+/**
+ * check_seek - Compare runs read after stream_decoder_seek() with the serial decoder
+ * @filename: Encoded file
+ * @ref: Frames from the serial decoder
+ * @frame_count: Number of frames in the stream
+ * @serial: Time the serial decoder took for the whole stream
+ *
+ * After the same runs as check_ranges(), the whole stream is read in one
+ * pass from a seek to frame 0, and again RANGE_BATCH frames per
+ * decode_range() call. The single pass must cost about what the serial
+ * decoder does, however long the run: each batch call goes back to the
+ * key frame, so the batched time grows with the GOP size instead.
+ *
+ * Return: 0 if every frame matched and the pass was not slow, 1 otherwise
+ */
+static int check_seek(const char *filename, const unsigned char *ref, int frame_count, double serial)
+{
+    encoder_context ctx;
+    stream_decoder dec;
+    video_frame frames[RANGE_BATCH];
+    const unsigned char *yuv;
+    double start, pass, batched;
+    int failed = 0;
+    FILE *fp;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return 1;
+    memset(&ctx, 0, sizeof(ctx));
+    if (stream_decoder_init(&dec, &ctx, fp) != 0) {
+        stream_decoder_free(&dec);
+        fclose(fp);
+        return 1;
+    }
+
+    for (int first = 0; first < frame_count; first += ctx.gop_size) {
+        int starts[] = {first - 1, first, first + 1};
+
+        for (int s = 0; s < 3; s++) {
+            int count = 2 * ctx.gop_size + 1;
+
+            if (starts[s] < 0 || starts[s] >= frame_count || stream_decoder_seek(&dec, starts[s]) != 0) {
+                failed |= starts[s] >= 0 && starts[s] < frame_count;
+                continue;
+            }
+            for (int i = starts[s]; i < starts[s] + count && i < frame_count; i++) {
+                yuv = decoder_next_frame(&dec);
+                if (!yuv || memcmp(yuv, ref + (size_t)i * ctx.yuv_size, ctx.yuv_size) != 0) {
+                    printf("  seek to %d, frame %d: MISMATCH\n", starts[s], i);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    start = now();
+    if (stream_decoder_seek(&dec, 0) != 0)
+        failed = 1;
+    for (int i = 0; i < frame_count && !failed; i++) {
+        yuv = decoder_next_frame(&dec);
+        if (!yuv || memcmp(yuv, ref + (size_t)i * ctx.yuv_size, ctx.yuv_size) != 0) {
+            printf("  one pass, frame %d: MISMATCH\n", i);
+            failed = 1;
+        }
+    }
+    pass = now() - start;
+
+    start = now();
+    for (int i = 0; i < frame_count && !failed; i += RANGE_BATCH) {
+        int count = frame_count - i < RANGE_BATCH ? frame_count - i : RANGE_BATCH;
+
+        failed |= decode_range(&ctx, fp, i, count, frames) != 0;
+        for (int k = 0; k < count && !failed; k++)
+            arena_free(&ctx.yuv_arena, frames[k].data);
+    }
+    batched = now() - start;
+
+    printf("  one pass   %8.3f ms (stream_decoder_seek to 0)\n", pass * 1e3);
+    printf("  batched    %8.3f ms (decode_range, %d frames a call)\n", batched * 1e3, RANGE_BATCH);
+    /* with slack for timer noise on short streams */
+    if (pass > 2 * serial + 0.01) {
+        printf("  one pass slower than the serial decoder\n");
+        failed = 1;
+    }
+
+    stream_decoder_free(&dec);
+    free_encoder(&ctx);
+    fclose(fp);
+
+    return failed;
+}
+
+/**
+ * check_threads - Compare decode_frames() with the serial decoder
+ * @data: Whole stream
+ * @size: Size of the stream
+ * @ref: Frames from the serial decoder
+ * @frame_count: Number of frames in the stream
+ * @threads: Threads to decode on
+ * @secs: Pointer to store the time to decode the whole stream
+ *
+ * The whole stream is decoded in one call, then runs starting on, just
+ * before and just after key frames, as a caller decoding in batches would.
+ *
+ * Return: 0 if every frame matched, 1 otherwise
+ */
+static int check_threads(unsigned char *data, size_t size, const unsigned char *ref, int frame_count, int threads,
+                         double *secs)
+{
+    encoder_context ctx;
+    stream_header hdr;
+    double start;
+    int failed;
+
+    memset(&ctx, 0, sizeof(ctx));
+    parse_stream_header(data, &hdr);
+    init_encoder(&ctx, hdr.width, hdr.height);
+    set_threads(&ctx, threads);
+
+    start = now();
+    failed = check_frames(&ctx, data, size, ref, 0, frame_count);
+    *secs = now() - start;
+
+    for (int first = 0; first < frame_count; first += hdr.gop_size) {
+        int starts[] = {first - 1, first, first + 1};
+
+        for (int s = 0; s < 3; s++) {
+            int counts[] = {1, hdr.gop_size, 2 * hdr.gop_size + 1};
+
+            if (starts[s] < 0 || starts[s] >= frame_count)
+                continue;
+            for (int c = 0; c < 3; c++) {
+                int count = counts[c] < frame_count - starts[s] ? counts[c] : frame_count - starts[s];
+
+                failed |= check_frames(&ctx, data, size, ref, starts[s], count);
+            }
+        }
+    }
+
+    free_encoder(&ctx);
+
+    return failed;
+}
+
+/**
+ * main - Entry point
+ * @argc: Argument count
+ * @argv: Encoded file to check
+ *
+ * Return: 0 if the decoders matched, 1 otherwise
+ */
+int main(int argc, char **argv)
+{
+    const char *filename;
+    encoder_context ctx;
+    unsigned char *data, *ref;
+    size_t size;
+    int frame_count;
+    int failed = 0;
+    double start, serial, secs;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <stream written by vid_codec>\n", argv[0]);
+        return 1;
+    }
+    filename = argv[1];
+
+    data = load_file(filename, &size);
+    memset(&ctx, 0, sizeof(ctx));
+    start = now();
+    ref = data ? decode_serial(&ctx, filename, &frame_count) : NULL;
+    serial = now() - start;
+    if (!ref) {
+        fprintf(stderr, "Error decoding %s\n", filename);
+        return 1;
+    }
+
+    printf("%s: %d frames of %dx%d, gop %d\n", filename, frame_count, ctx.width, ctx.height, ctx.gop_size);
+    printf("  serial     %8.3f ms\n", serial * 1e3);
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+        failed |= check_threads(data, size, ref, frame_count, thread_counts[t], &secs);
+        printf("  %d threads  %8.3f ms\n", thread_counts[t], secs * 1e3);
+    }
+    failed |= check_ranges(filename, ref, frame_count, &secs);
+    printf("  last frame %8.3f ms (decode_range)\n", secs * 1e3);
+    failed |= check_seek(filename, ref, frame_count, serial);
+    printf("bit exactness: %s\n", failed ? "FAILED" : "ok");
+
+    free_encoder(&ctx);
+    free(ref);
+    free(data);
+
+    return failed;
+}
@@ -0,0 +1,134 @@
+// bench_delta.c
+/*
+ * Benchmark of the delta and reconstruct kernels against the original
+ * byte loop. Build with:
+ *   gcc -O2 -pthread bench_delta.c delta_simd.c -o bench_delta
+ */
+#include "codec.h"
+#include <time.h>
+
+#define BENCH_ROUNDS 200
+
+/**
+ * now - Monotonic time in seconds
+ *
+ * Return: Current time
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * subtract_loop - The delta loop as it was in create_delta_frames
+ * @frame: Frame to turn into a delta
+ * @prev: Previous frame
+ */
+static void subtract_loop(video_frame *frame, video_frame *prev)
+{
+    for (int j = 0; j < (int)frame->size; j++)
+        frame->data[j] -= prev->data[j];
+}
+
+/**
+ * bench_size - Time every kernel on one frame size
+ * @width: Frame width
+ * @height: Frame height
+ *
+ * Return: 0 if every kernel matched the byte loop, 1 otherwise
+ */
+static int bench_size(int width, int height)
+{
+    static const char *names[] = {"scalar", "sse2", "avx2", "avx512"};
+    encoder_context ctx;
+    video_frame cur, prev;
+    unsigned char *expect, *out;
+    double start, secs;
+    int failed = 0;
+
+    ctx.width = width;
+    ctx.height = height;
+    ctx.yuv_size = width * height + (width * height / 2);
+
+    cur.size = prev.size = ctx.yuv_size;
+    cur.data = malloc(ctx.yuv_size);
+    prev.data = malloc(ctx.yuv_size);
+    expect = malloc(ctx.yuv_size);
+    out = malloc(ctx.yuv_size);
+    for (size_t j = 0; j < ctx.yuv_size; j++) {
+        cur.data[j] = rand();
+        prev.data[j] = rand();
+    }
+
+    printf("%dx%d (%zu bytes per frame)\n", width, height, ctx.yuv_size);
+
+    /* the loop works in place, time it on a scratch copy */
+    memcpy(out, cur.data, ctx.yuv_size);
+    start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        video_frame scratch = {out, ctx.yuv_size};
+
+        subtract_loop(&scratch, &prev);
+    }
+    secs = (now() - start) / BENCH_ROUNDS;
+    printf("  %-8s subtract %8.3f ms  %6.2f GB/s\n", "loop", secs * 1e3, ctx.yuv_size / secs / 1e9);
+
+    video_frame reference = {expect, ctx.yuv_size};
+    memcpy(expect, cur.data, ctx.yuv_size);
+    subtract_loop(&reference, &prev);
+
+    for (simd_level level = SIMD_NONE; level <= SIMD_AVX512; level++) {
+        if (select_delta_kernels(level) != level)
+            continue;
+
+        /* in place like the loop, then once more to check the result */
+        start = now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            subtract_frame(out, out, prev.data, ctx.yuv_size);
+        secs = (now() - start) / BENCH_ROUNDS;
+        printf("  %-8s subtract %8.3f ms  %6.2f GB/s", names[level], secs * 1e3, ctx.yuv_size / secs / 1e9);
+        subtract_frame(out, cur.data, prev.data, ctx.yuv_size);
+        if (memcmp(out, expect, ctx.yuv_size) != 0) {
+            printf("  MISMATCH");
+            failed = 1;
+        }
+
+        start = now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            add_frame(out, out, prev.data, ctx.yuv_size);
+        secs = (now() - start) / BENCH_ROUNDS;
+        printf("  add %8.3f ms", secs * 1e3);
+        add_frame(out, expect, prev.data, ctx.yuv_size);
+        if (memcmp(out, cur.data, ctx.yuv_size) != 0) {
+            printf("  MISMATCH");
+            failed = 1;
+        }
+        printf("\n");
+    }
+
+    free(cur.data);
+    free(prev.data);
+    free(expect);
+    free(out);
+
+    return failed;
+}
+
+/**
+ * main - Entry point
+ *
+ * Return: 0 if all kernels matched, 1 otherwise
+ */
+int main(void)
+{
+    int failed = 0;
+
+    failed |= bench_size(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    failed |= bench_size(1920, 1080);
+    failed |= bench_size(3840, 2160);
+
+    return failed;
+}
@@ -0,0 +1,536 @@
+// bench_vcodec.c
+/*
+ * Round trip check of libvcodec. Frames are encoded through a write
+ * callback and decoded through a read callback, the stream has to match
+ * what vid_codec writes for the same frames and the decoded frames what
+ * the serial stream decoder of vid_decode gets out of it. Build with:
+ *   gcc -O2 -pthread bench_vcodec.c $(ls *.c | grep -v -E '^(main|vid_codec|vid_decode|bench_.*)\.c$') -lz -lm -o bench_vcodec
+ */
+#include "codec.h"
+#include "vcodec.h"
+#include <time.h>
+#include <unistd.h>
+
+/* odd sizes, so chroma planes are rounded up and rows have a tail */
+#define TEST_WIDTH 383
+#define TEST_HEIGHT 215
+#define TEST_FRAMES 23
+#define TEST_GOP 7
+/* extra bytes at the end of each row of a strided frame */
+#define STRIDE_PAD 13
+
+static const int thread_counts[] = {1, 3};
+static const char *format_names[] = {"yuv420p", "rgb24"};
+
+/* an encoded stream held in memory, written and read through callbacks */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t cap;
+    size_t pos;
+} mem_stream;
+
+/**
+ * now - Monotonic time in seconds
+ *
+ * Return: Current time
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * mem_write - Append encoded bytes to a memory stream
+ * @opaque: Memory stream
+ * @data: Bytes to write
+ * @size: Number of bytes
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int mem_write(void *opaque, const unsigned char *data, size_t size)
+{
+    mem_stream *ms = opaque;
+
+    if (ms->size + size > ms->cap) {
+        size_t cap = ms->cap ? ms->cap : 4096;
+        unsigned char *tmp;
+
+        while (cap < ms->size + size)
+            cap *= 2;
+        tmp = realloc(ms->data, cap);
+        if (!tmp)
+            return -1;
+        ms->data = tmp;
+        ms->cap = cap;
+    }
+    memcpy(ms->data + ms->size, data, size);
+    ms->size += size;
+
+    return 0;
+}
+
+/**
+ * mem_read - Hand out the next bytes of a memory stream
+ * @opaque: Memory stream
+ * @data: Buffer to fill
+ * @size: Bytes wanted
+ *
+ * Return: Number of bytes stored, 0 at the end
+ */
+static size_t mem_read(void *opaque, unsigned char *data, size_t size)
+{
+    mem_stream *ms = opaque;
+
+    if (size > ms->size - ms->pos)
+        size = ms->size - ms->pos;
+    memcpy(data, ms->data + ms->pos, size);
+    ms->pos += size;
+
+    return size;
+}
+
+/**
+ * frame_bytes - Size of a packed frame
+ * @ctx: Encoder context
+ * @format: Frame format
+ *
+ * Return: Bytes per frame
+ */
+static size_t frame_bytes(const encoder_context *ctx, vc_format format)
+{
+    return format == VC_FORMAT_RGB24 ? ctx->frame_size : ctx->yuv_size;
+}
+
+/**
+ * layout_frame - Lay out a frame the way a caller of libvcodec would
+ * @ctx: Encoder context
+ * @format: Frame format
+ * @pad: Extra bytes at the end of every row
+ * @buf: Buffer for the frame, frame_bytes() plus @pad per row
+ * @planes: Pointer to store the plane pointers
+ * @strides: Pointer to store the plane strides
+ */
+static void layout_frame(const encoder_context *ctx, vc_format format, int pad, unsigned char *buf,
+                         unsigned char *planes[3], int strides[3])
+{
+    if (format == VC_FORMAT_RGB24) {
+        planes[0] = buf;
+        strides[0] = ctx->width * 3 + pad;
+        planes[1] = planes[2] = NULL;
+        strides[1] = strides[2] = 0;
+        return;
+    }
+
+    for (int p = 0; p < 3; p++) {
+        strides[p] = (p ? ctx->chroma_width : ctx->width) + pad;
+        planes[p] = buf;
+        buf += (size_t)strides[p] * (p ? ctx->chroma_height : ctx->height);
+    }
+}
+
+/**
+ * copy_frame - Copy a frame between the packed layout and a caller's planes
+ * @ctx: Encoder context
+ * @format: Frame format
+ * @packed: Packed frame
+ * @planes: Planes from layout_frame()
+ * @strides: Strides from layout_frame()
+ * @to_planes: Non zero to copy @packed into @planes, 0 the other way
+ */
+static void copy_frame(const encoder_context *ctx, vc_format format, unsigned char *packed,
+                       unsigned char *const planes[3], const int strides[3], int to_planes)
+{
+    int count = format == VC_FORMAT_RGB24 ? 1 : 3;
+
+    for (int p = 0; p < count; p++) {
+        int row = format == VC_FORMAT_RGB24 ? ctx->width * 3 : p ? ctx->chroma_width : ctx->width;
+        int rows = p ? ctx->chroma_height : ctx->height;
+
+        for (int i = 0; i < rows; i++, packed += row) {
+            if (to_planes) {
+                memcpy(planes[p] + (size_t)i * strides[p], packed, row);
+            } else {
+                memcpy(packed, planes[p] + (size_t)i * strides[p], row);
+            }
+        }
+    }
+}
+
+/**
+ * make_frames - Make RGB24 test frames
+ * @ctx: Encoder context
+ * @count: Number of frames
+ *
+ * A gradient that moves from frame to frame with a noisy block wandering
+ * across it, so both the deltas and the deflate have something to do.
+ *
+ * Return: Frames back to back, or NULL on failure
+ */
+static unsigned char *make_frames(const encoder_context *ctx, int count)
+{
+    unsigned char *frames = malloc(ctx->frame_size * count);
+
+    for (int f = 0; frames && f < count; f++) {
+        unsigned char *p = frames + ctx->frame_size * f;
+
+        for (int i = 0; i < ctx->height; i++) {
+            for (int j = 0; j < ctx->width; j++, p += 3) {
+                int noise = abs(i - 5 * f) < 20 && abs(j - 11 * f) < 40 ? rand() & 63 : 0;
+
+                p[0] = j + 3 * f + noise;
+                p[1] = i * 2 - f + noise;
+                p[2] = (i + j) / 2 + noise;
+            }
+        }
+    }
+
+    return frames;
+}
+
+/**
+ * encode_vc - Encode frames through libvcodec
+ * @ctx: Encoder context, for the frame size
+ * @format: Format of @frames
+ * @frames: Packed frames back to back
+ * @threads: Encoder threads
+ * @pad: Extra bytes at the end of every row passed in
+ * @out: Memory stream for the encoded stream
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int encode_vc(const encoder_context *ctx, vc_format format, unsigned char *frames, int threads, int pad,
+                     mem_stream *out)
+{
+    vc_encoder_params params = {0};
+    unsigned char *buf, *planes[3];
+    int strides[3];
+    vc_encoder *enc;
+    int ret = -1;
+
+    params.width = ctx->width;
+    params.height = ctx->height;
+    params.gop_size = TEST_GOP;
+    params.threads = threads;
+    params.format = format;
+    params.write = mem_write;
+    params.opaque = out;
+
+    buf = malloc(frame_bytes(ctx, format) + (size_t)pad * (ctx->height + 2 * ctx->chroma_height));
+    enc = buf ? vc_encoder_create(&params) : NULL;
+    if (!enc)
+        goto done;
+
+    layout_frame(ctx, format, pad, buf, planes, strides);
+    for (int f = 0; f < TEST_FRAMES; f++) {
+        copy_frame(ctx, format, frames + frame_bytes(ctx, format) * f, planes, strides, 1);
+        if (vc_encode_frame(enc, (const unsigned char *const *)planes, strides) != 0)
+            goto done;
+    }
+    if (vc_flush(enc) == 0 && vc_encoder_frame_count(enc) == TEST_FRAMES)
+        ret = 0;
+
+done:
+    vc_encoder_destroy(enc);
+    free(buf);
+    return ret;
+}
+
+/**
+ * encode_file - Encode RGB24 frames the way vid_codec does
+ * @rgb: Frames back to back
+ * @threads: Encoder threads
+ * @out: Memory stream for the encoded stream
+ *
+ * The frames go through a temporary file, which open_source() maps.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int encode_file(unsigned char *rgb, int threads, mem_stream *out)
+{
+    char path[] = "/tmp/bench_vcodec_XXXXXX";
+    encoder_context ctx;
+    frame_source src;
+    FILE *fp = NULL;
+    int frame_count = 0;
+    int fd, ret = -1;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fps = DEFAULT_FPS;
+    init_encoder(&ctx, TEST_WIDTH, TEST_HEIGHT);
+
+    fd = mkstemp(path);
+    if (fd < 0)
+        goto done;
+    if (write(fd, rgb, ctx.frame_size * TEST_FRAMES) != (ssize_t)(ctx.frame_size * TEST_FRAMES)) {
+        close(fd);
+        goto done;
+    }
+    close(fd);
+
+    if (open_source(&ctx, &src, path, INPUT_RGB24, 1) != 0)
+        goto done;
+    ctx.gop_size = TEST_GOP;
+    if (set_threads(&ctx, threads) == 0 && (fp = open_memstream((char **)&out->data, &out->size)))
+        ret = encode_stream(&ctx, &src, fp, &frame_count) == 0 && frame_count == TEST_FRAMES ? 0 : -1;
+    close_source(&src);
+    if (fp && fclose(fp) != 0)
+        ret = -1;
+
+done:
+    unlink(path);
+    free_encoder(&ctx);
+    return ret;
+}
+
+/**
+ * decode_serial - Decode a stream with the serial decoder, as vid_decode does
+ * @ctx: Unsized encoder context, set up from the stream header
+ * @stream: Encoded stream
+ *
+ * Return: YUV420 frames back to back, or NULL on failure
+ */
+static unsigned char *decode_serial(encoder_context *ctx, mem_stream *stream)
+{
+    stream_decoder dec = {0};
+    const unsigned char *yuv = NULL;
+    unsigned char *frames = NULL;
+    int count = 0;
+    FILE *fp;
+
+    fp = fmemopen(stream->data, stream->size, "rb");
+    if (!fp)
+        return NULL;
+    if (stream_decoder_init(&dec, ctx, fp) == 0 && (frames = malloc(ctx->yuv_size * TEST_FRAMES))) {
+        while ((yuv = decoder_next_frame(&dec)) && count < TEST_FRAMES)
+            memcpy(frames + ctx->yuv_size * count++, yuv, ctx->yuv_size);
+    }
+    if (dec.error || yuv || count != TEST_FRAMES) {
+        free(frames);
+        frames = NULL;
+    }
+    if (dec.ctx)
+        stream_decoder_free(&dec);
+    fclose(fp);
+
+    return frames;
+}
+
+/**
+ * check_decode - Decode a stream through libvcodec and compare the frames
+ * @ctx: Encoder context sized from the stream
+ * @stream: Encoded stream
+ * @format: Format to decode to
+ * @threads: Decoder threads
+ * @pad: Extra bytes at the end of every row asked for
+ * @ref: Packed frames the decode has to give, back to back
+ * @secs: Pointer to store the time taken
+ *
+ * Return: 0 if every frame matched, 1 otherwise
+ */
+static int check_decode(const encoder_context *ctx, mem_stream *stream, vc_format format, int threads, int pad,
+                        const unsigned char *ref, double *secs)
+{
+    vc_decoder_params params = {0};
+    size_t size = frame_bytes(ctx, format);
+    unsigned char *buf, *packed, *planes[3];
+    int strides[3];
+    vc_stream_info info;
+    vc_decoder *dec = NULL;
+    int count = 0, ret;
+    int failed = 1;
+    double start = now();
+
+    params.threads = threads;
+    params.format = format;
+    params.read = mem_read;
+    params.opaque = stream;
+    stream->pos = 0;
+
+    buf = malloc(size + (size_t)pad * (ctx->height + 2 * ctx->chroma_height));
+    packed = malloc(size);
+    if (buf && packed)
+        dec = vc_decoder_create(&params);
+    if (!dec)
+        goto done;
+
+    vc_decoder_info(dec, &info);
+    if (info.width != ctx->width || info.height != ctx->height || info.gop_size != TEST_GOP)
+        goto done;
+
+    layout_frame(ctx, format, pad, buf, planes, strides);
+    while ((ret = vc_decode_frame(dec, planes, strides)) == 1 && count < TEST_FRAMES) {
+        copy_frame(ctx, format, packed, planes, strides, 0);
+        if (memcmp(packed, ref + size * count, size) != 0)
+            goto done;
+        count++;
+    }
+    failed = ret != 0 || count != TEST_FRAMES;
+
+done:
+    *secs = now() - start;
+    if (failed)
+        printf("  decode to %s, %d threads, stride pad %d: MISMATCH after %d frames\n", format_names[format], threads,
+               pad, count);
+    vc_decoder_destroy(dec);
+    free(buf);
+    free(packed);
+    return failed;
+}
+
+/**
+ * check_unknown_format - Check a format outside vc_format is turned down
+ *
+ * Return: 0 if both the encoder and the decoder refused it, 1 otherwise
+ */
+static int check_unknown_format(void)
+{
+    vc_encoder_params enc_params = {0};
+    vc_decoder_params dec_params = {0};
+    mem_stream ms = {0};
+    vc_encoder *enc;
+    vc_decoder *dec;
+    int failed = 0;
+
+    enc_params.width = TEST_WIDTH;
+    enc_params.height = TEST_HEIGHT;
+    enc_params.format = (vc_format)7;
+    enc_params.write = mem_write;
+    enc_params.opaque = &ms;
+    dec_params.format = (vc_format)-1;
+    dec_params.read = mem_read;
+    dec_params.opaque = &ms;
+
+    enc = vc_encoder_create(&enc_params);
+    dec = vc_decoder_create(&dec_params);
+    if (enc || dec || ms.size) {
+        printf("  unknown frame format: ACCEPTED\n");
+        failed = 1;
+    }
+    vc_encoder_destroy(enc);
+    vc_decoder_destroy(dec);
+    free(ms.data);
+
+    return failed;
+}
+
+/**
+ * check_threads - Round trip the test frames with one thread count
+ * @ctx: Encoder context of the test size
+ * @rgb: RGB24 test frames
+ * @yuv: The same frames converted to YUV420
+ * @threads: Encoder and decoder threads
+ *
+ * The stream of RGB24 frames, packed or strided, and of the same frames
+ * pushed as YUV420 has to be the one vid_codec writes. Decoding it has
+ * to give back the YUV420 frames exactly, and the RGB24 frames
+ * vid_decode makes of them.
+ *
+ * Return: 0 if everything matched, 1 otherwise
+ */
+static int check_threads(encoder_context *ctx, unsigned char *rgb, unsigned char *yuv, int threads)
+{
+    mem_stream ref = {0}, out = {0};
+    encoder_context dec_ctx;
+    unsigned char *frames = NULL, *decoded = NULL;
+    double start, encode_secs, decode_secs;
+    int failed = 0;
+
+    memset(&dec_ctx, 0, sizeof(dec_ctx));
+    if (encode_file(rgb, threads, &ref) != 0 || !(frames = decode_serial(&dec_ctx, &ref))) {
+        printf("  vid_codec stream with %d threads: FAILED\n", threads);
+        failed = 1;
+        goto done;
+    }
+    if (memcmp(frames, yuv, ctx->yuv_size * TEST_FRAMES) != 0) {
+        printf("  vid_codec stream with %d threads: frames changed\n", threads);
+        failed = 1;
+    }
+
+    for (int f = 0; f < 2; f++) {
+        for (int pad = 0; pad <= STRIDE_PAD; pad += STRIDE_PAD) {
+            vc_format format = f ? VC_FORMAT_RGB24 : VC_FORMAT_YUV420P;
+
+            free(out.data);
+            memset(&out, 0, sizeof(out));
+            start = now();
+            if (encode_vc(ctx, format, format == VC_FORMAT_RGB24 ? rgb : yuv, threads, pad, &out) != 0 ||
+                out.size != ref.size || memcmp(out.data, ref.data, ref.size) != 0) {
+                printf("  encode from %s, %d threads, stride pad %d: MISMATCH\n", format_names[format], threads, pad);
+                failed = 1;
+            }
+            encode_secs = now() - start;
+        }
+    }
+    printf("  %d threads  encode %8.3f ms", threads, encode_secs * 1e3);
+
+    /* what vid_decode writes for -f rgb24 */
+    decoded = malloc(ctx->frame_size * TEST_FRAMES);
+    if (!decoded) {
+        failed = 1;
+        goto done;
+    }
+    for (int f = 0; f < TEST_FRAMES; f++) {
+        yuv_frame src;
+
+        init_packed_frame(ctx, frames + ctx->yuv_size * f, &src);
+        yuv420_to_rgb(ctx, &src, decoded + ctx->frame_size * f);
+    }
+
+    failed |= check_decode(ctx, &ref, VC_FORMAT_YUV420P, threads, 0, yuv, &decode_secs);
+    failed |= check_decode(ctx, &ref, VC_FORMAT_YUV420P, threads, STRIDE_PAD, yuv, &decode_secs);
+    failed |= check_decode(ctx, &ref, VC_FORMAT_RGB24, threads, STRIDE_PAD, decoded, &decode_secs);
+    failed |= check_decode(ctx, &ref, VC_FORMAT_RGB24, threads, 0, decoded, &decode_secs);
+    printf("  decode %8.3f ms\n", decode_secs * 1e3);
+
+done:
+    if (dec_ctx.width)
+        free_encoder(&dec_ctx);
+    free(frames);
+    free(decoded);
+    free(ref.data);
+    free(out.data);
+    return failed;
+}
+
+/**
+ * main - Entry point
+ *
+ * Return: 0 if every round trip matched, 1 otherwise
+ */
+int main(void)
+{
+    encoder_context ctx;
+    unsigned char *rgb, *yuv;
+    int failed = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    init_encoder(&ctx, TEST_WIDTH, TEST_HEIGHT);
+    rgb = make_frames(&ctx, TEST_FRAMES);
+    yuv = malloc(ctx.yuv_size * TEST_FRAMES);
+    if (!rgb || !yuv) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int f = 0; f < TEST_FRAMES; f++) {
+        yuv_frame frame;
+
+        init_packed_frame(&ctx, yuv + ctx.yuv_size * f, &frame);
+        rgb_to_yuv420(&ctx, rgb + ctx.frame_size * f, &frame);
+    }
+
+    printf("%d frames of %dx%d, gop %d\n", TEST_FRAMES, TEST_WIDTH, TEST_HEIGHT, TEST_GOP);
+    for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
+        failed |= check_threads(&ctx, rgb, yuv, thread_counts[t]);
+    failed |= check_unknown_format();
+    printf("round trip: %s\n", failed ? "FAILED" : "ok");
+
+    free_encoder(&ctx);
+    free(rgb);
+    free(yuv);
+
+    return failed;
+}
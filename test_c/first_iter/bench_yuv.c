@@ -0,0 +1,371 @@
+// bench_yuv.c
+/*
+ * Bit exactness check and benchmark of the vector RGB24 to YUV420
+ * kernels against rgb_to_yuv420_fixed(), and of the YUV420 to RGB24
+ * ones against yuv420_to_rgb_fixed(), and check of the borders
+ * extend_frame_border() fills in. Build with:
+ *   gcc -O2 -pthread bench_yuv.c convert_to_yuv_simd.c convert_to_yuv_fixed.c convert_to_rgb.c convert_to_rgb_simd.c \
+ *       thread_pool.c helper_fn.c yuv_frame.c -lz -lm -o bench_yuv
+ */
+#include "codec.h"
+#include <time.h>
+
+#define BENCH_ROUNDS 50
+/* every width and height up to these is checked, covering each tail length */
+#define CHECK_MAX_WIDTH 100
+#define CHECK_MAX_HEIGHT 6
+/* fill of the output buffers, so writes outside the visible samples show up */
+#define CANARY 0xa5
+/* bytes past the end of an RGB24 output that must keep the canary */
+#define CANARY_TAIL 64
+/* most bands a YUV420 to RGB24 frame is cut into, as by that many threads */
+#define MAX_BANDS 4
+
+typedef void (*yuv_kernel)(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+typedef void (*rgb_kernel)(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+
+static const char *names[] = {"fixed", "sse4.1", "avx2"};
+static yuv_kernel kernels[] = {rgb_to_yuv420_fixed, rgb_to_yuv420_sse41, rgb_to_yuv420_avx2};
+static rgb_kernel rgb_kernels[] = {yuv420_to_rgb_fixed, yuv420_to_rgb_sse41, yuv420_to_rgb_avx2};
+
+/**
+ * now - Monotonic time in seconds
+ *
+ * Return: Current time
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * kernel_available - Check the CPU can run a kernel
+ * @k: Index into kernels
+ *
+ * Return: Non zero if it can
+ */
+static int kernel_available(int k)
+{
+    return k == 0 || (k == 1 && cpu_has_sse41()) || (k == 2 && cpu_has_avx2());
+}
+
+/**
+ * set_size - Size a context for the kernels
+ * @ctx: Context to fill in
+ * @width: Frame width
+ * @height: Frame height
+ */
+static void set_size(encoder_context *ctx, int width, int height)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->width = width;
+    ctx->height = height;
+    ctx->chroma_width = (width + 1) / 2;
+    ctx->chroma_height = (height + 1) / 2;
+    ctx->frame_size = (size_t)width * height * 3;
+    ctx->yuv_size = (size_t)width * height + 2 * (size_t)ctx->chroma_width * ctx->chroma_height;
+}
+
+/**
+ * convert - Run a kernel over a frame the way the encoder does
+ * @ctx: Encoder context
+ * @kernel: Kernel to run
+ * @rgb: RGB24 frame
+ * @yuv: Output frame
+ * @split: Even row the frame is split at, as between two threads
+ */
+static void convert(encoder_context *ctx, yuv_kernel kernel, const unsigned char *rgb, const yuv_frame *yuv, int split)
+{
+    kernel(ctx, rgb, yuv, 0, split);
+    kernel(ctx, rgb, yuv, split, ctx->height);
+}
+
+/**
+ * check_size - Compare every kernel with the scalar one on one frame size
+ * @width: Frame width
+ * @height: Frame height
+ *
+ * Both layouts are checked, packed and padded, the whole buffer is
+ * compared so stray writes into gaps and past the end count too.
+ *
+ * Return: 0 if every kernel matched byte for byte, 1 otherwise
+ */
+static int check_size(int width, int height)
+{
+    encoder_context ctx;
+    unsigned char *rgb, *expect, *out;
+    size_t size;
+    int split = height / 2 & ~1;
+    int failed = 0;
+
+    set_size(&ctx, width, height);
+    size = padded_frame_size(&ctx, 0);
+    if (size < ctx.yuv_size)
+        size = ctx.yuv_size;
+
+    rgb = malloc(ctx.frame_size);
+    expect = aligned_alloc(FRAME_ALIGN, (size + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN);
+    out = aligned_alloc(FRAME_ALIGN, (size + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN);
+    for (size_t j = 0; j < ctx.frame_size; j++)
+        rgb[j] = rand();
+
+    for (int padded = 0; padded < 2; padded++) {
+        yuv_frame yuv_expect, yuv_out;
+
+        memset(expect, CANARY, size);
+        if (padded) {
+            init_padded_frame(&ctx, expect, 0, &yuv_expect);
+        } else {
+            init_packed_frame(&ctx, expect, &yuv_expect);
+        }
+        convert(&ctx, rgb_to_yuv420_fixed, rgb, &yuv_expect, split);
+
+        for (int k = 1; k < 3; k++) {
+            if (!kernel_available(k))
+                continue;
+
+            memset(out, CANARY, size);
+            if (padded) {
+                init_padded_frame(&ctx, out, 0, &yuv_out);
+            } else {
+                init_packed_frame(&ctx, out, &yuv_out);
+            }
+            convert(&ctx, kernels[k], rgb, &yuv_out, split);
+
+            if (memcmp(out, expect, size) != 0) {
+                printf("MISMATCH: %s at %dx%d, %s\n", names[k], width, height, padded ? "padded" : "packed");
+                failed = 1;
+            }
+        }
+    }
+
+    free(rgb);
+    free(expect);
+    free(out);
+
+    return failed;
+}
+
+/**
+ * convert_rgb - Run a YUV420 to RGB24 kernel the way yuv420_to_rgb() does
+ * @ctx: Encoder context
+ * @kernel: Kernel to run
+ * @yuv: YUV420 frame
+ * @rgb: Output buffer
+ * @threads: Number of threads the rows are shared between
+ *
+ * Bands are ceil(height / @threads) rows, so they can start on odd rows.
+ */
+static void convert_rgb(encoder_context *ctx, rgb_kernel kernel, const yuv_frame *yuv, unsigned char *rgb, int threads)
+{
+    int band_rows = (ctx->height + threads - 1) / threads;
+
+    for (int start = 0; start < ctx->height; start += band_rows)
+        kernel(ctx, yuv, rgb, start, start + band_rows < ctx->height ? start + band_rows : ctx->height);
+}
+
+/**
+ * check_rgb_size - Compare every YUV420 to RGB24 kernel with the scalar one
+ * @width: Frame width
+ * @height: Frame height
+ *
+ * The planes are random, packed and padded, and each kernel runs whole
+ * and cut into bands. The output is compared along with CANARY_TAIL
+ * bytes after it, so writes past the last pixel count too.
+ *
+ * Return: 0 if every kernel matched byte for byte, 1 otherwise
+ */
+static int check_rgb_size(int width, int height)
+{
+    encoder_context ctx;
+    unsigned char *in, *expect, *out;
+    size_t size, rgb_size;
+    int failed = 0;
+
+    set_size(&ctx, width, height);
+    size = padded_frame_size(&ctx, 0);
+    if (size < ctx.yuv_size)
+        size = ctx.yuv_size;
+    rgb_size = ctx.frame_size + CANARY_TAIL;
+
+    in = aligned_alloc(FRAME_ALIGN, (size + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN);
+    expect = malloc(rgb_size);
+    out = malloc(rgb_size);
+    for (size_t j = 0; j < size; j++)
+        in[j] = rand();
+
+    for (int padded = 0; padded < 2; padded++) {
+        yuv_frame yuv;
+
+        if (padded) {
+            init_padded_frame(&ctx, in, 0, &yuv);
+        } else {
+            init_packed_frame(&ctx, in, &yuv);
+        }
+
+        memset(expect, CANARY, rgb_size);
+        yuv420_to_rgb_fixed(&ctx, &yuv, expect, 0, height);
+
+        for (int k = 0; k < 3; k++) {
+            if (!kernel_available(k))
+                continue;
+
+            for (int threads = 1; threads <= MAX_BANDS; threads++) {
+                memset(out, CANARY, rgb_size);
+                convert_rgb(&ctx, rgb_kernels[k], &yuv, out, threads);
+
+                if (memcmp(out, expect, rgb_size) != 0) {
+                    printf("MISMATCH: %s to rgb at %dx%d, %s, %d bands\n", names[k], width, height,
+                           padded ? "padded" : "packed", threads);
+                    failed = 1;
+                }
+            }
+        }
+    }
+
+    free(in);
+    free(expect);
+    free(out);
+
+    return failed;
+}
+
+/**
+ * check_border - Check extend_frame_border() on one frame size
+ * @width: Frame width
+ * @height: Frame height
+ * @border: Samples of border around the Y plane
+ *
+ * Every byte of the padded buffer is checked: inside the border it must
+ * be the nearest visible sample of its plane, outside of it, in the
+ * alignment gaps, it must still hold the canary.
+ *
+ * Return: 0 if the border was filled right, 1 otherwise
+ */
+static int check_border(int width, int height, int border)
+{
+    encoder_context ctx;
+    unsigned char *data, *base;
+    yuv_frame yuv;
+    size_t size;
+    int failed = 0;
+
+    set_size(&ctx, width, height);
+    size = padded_frame_size(&ctx, border);
+    data = aligned_alloc(FRAME_ALIGN, size);
+    memset(data, CANARY, size);
+    init_padded_frame(&ctx, data, border, &yuv);
+    base = data;
+
+    for (int p = 0; p < 3; p++)
+        for (int i = 0; i < yuv.height[p]; i++)
+            for (int j = 0; j < yuv.width[p]; j++)
+                yuv.plane[p][(size_t)i * yuv.stride[p] + j] = rand();
+    extend_frame_border(&yuv);
+
+    /* planes follow each other, each height + 2 * border rows of stride */
+    for (int p = 0, b = border; p < 3; p++, b = (border + 1) / 2) {
+        int w = yuv.width[p], h = yuv.height[p], stride = yuv.stride[p];
+        int left = yuv.plane[p] - base - (ptrdiff_t)b * stride;
+
+        for (int i = -b; i < h + b && !failed; i++) {
+            const unsigned char *row = yuv.plane[p] + (ptrdiff_t)i * stride;
+            const unsigned char *edge = yuv.plane[p] + (size_t)(i < 0 ? 0 : i >= h ? h - 1 : i) * stride;
+
+            for (int j = -left; j < stride - left; j++) {
+                int expect = j < -b || j >= w + b ? CANARY : edge[j < 0 ? 0 : j >= w ? w - 1 : j];
+
+                if (row[j] != expect) {
+                    printf("MISMATCH: border %d of plane %d at %dx%d, row %d column %d\n", border, p, width, height, i, j);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+        base += (size_t)stride * (h + 2 * b);
+    }
+    if (!failed && base != data + size) {
+        printf("MISMATCH: border %d planes end %td bytes off at %dx%d\n", border, base - (data + size), width, height);
+        failed = 1;
+    }
+
+    free(data);
+
+    return failed;
+}
+
+/**
+ * bench_size - Time every kernel, both ways, on one frame size
+ * @width: Frame width
+ * @height: Frame height
+ */
+static void bench_size(int width, int height)
+{
+    encoder_context ctx;
+    unsigned char *rgb, *out;
+    yuv_frame yuv;
+    double start, secs;
+
+    set_size(&ctx, width, height);
+    rgb = malloc(ctx.frame_size);
+    out = malloc(ctx.yuv_size);
+    for (size_t j = 0; j < ctx.frame_size; j++)
+        rgb[j] = rand();
+    init_packed_frame(&ctx, out, &yuv);
+
+    printf("%dx%d (%zu bytes per frame)\n", width, height, ctx.frame_size);
+    for (int k = 0; k < 3; k++) {
+        if (!kernel_available(k))
+            continue;
+
+        start = now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            kernels[k](&ctx, rgb, &yuv, 0, height);
+        secs = (now() - start) / BENCH_ROUNDS;
+        printf("  to yuv %-8s %8.3f ms  %6.2f GB/s\n", names[k], secs * 1e3, ctx.frame_size / secs / 1e9);
+
+        start = now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            rgb_kernels[k](&ctx, &yuv, rgb, 0, height);
+        secs = (now() - start) / BENCH_ROUNDS;
+        printf("  to rgb %-8s %8.3f ms  %6.2f GB/s\n", names[k], secs * 1e3, ctx.frame_size / secs / 1e9);
+    }
+
+    free(rgb);
+    free(out);
+}
+
+/**
+ * main - Entry point
+ *
+ * Return: 0 if all kernels matched, 1 otherwise
+ */
+int main(void)
+{
+    static const int sizes[][2] = {{383, 215}, {1919, 1081}, {1920, 1080}};
+    /* odd ones give the chroma planes a border of half rounded up */
+    static const int borders[] = {1, 2, 3, 16, 33, 64};
+    int failed = 0;
+
+    for (int h = 1; h <= CHECK_MAX_HEIGHT; h++)
+        for (int w = 1; w <= CHECK_MAX_WIDTH; w++)
+            failed |= check_size(w, h) | check_rgb_size(w, h);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        failed |= check_size(sizes[s][0], sizes[s][1]) | check_rgb_size(sizes[s][0], sizes[s][1]);
+    for (size_t b = 0; b < sizeof(borders) / sizeof(borders[0]); b++) {
+        for (int h = 1; h <= CHECK_MAX_HEIGHT; h++)
+            for (int w = 1; w <= CHECK_MAX_WIDTH; w++)
+                failed |= check_border(w, h, borders[b]);
+        failed |= check_border(sizes[0][0], sizes[0][1], borders[b]);
+    }
+    printf("bit exactness: %s (sse4.1 %s, avx2 %s)\n", failed ? "FAILED" : "ok",
+           cpu_has_sse41() ? "checked" : "not supported", cpu_has_avx2() ? "checked" : "not supported");
+
+    bench_size(DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    bench_size(1920, 1080);
+
+    return failed;
+}
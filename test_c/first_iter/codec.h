@@ -3,13 +3,46 @@
 
 // #include <cstddef>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <zlib.h>
+#include <pthread.h>
+
+/* Frame buffers from the arena start on this boundary, a cache line and an AVX-512 vector */
+#define FRAME_ALIGN 64
+/* Buffers added to the arena at a time once it runs dry */
+#define ARENA_GROW 8
 
 /* Default video conditions */
 #define DEFAULT_WIDTH 384
 #define DEFAULT_HEIGHT 216
+#define DEFAULT_FPS 25
+/* a key frame every two seconds at the default rate */
+#define DEFAULT_GOP_SIZE 50
+/* largest width or height taken from a stream header, Y4M header or caller */
+#define MAX_DIMENSION 16384
+
+/* Container format, see container.c */
+#define STREAM_MAGIC "VCDC"
+#define STREAM_FOOTER_MAGIC "VEND"
+#define STREAM_VERSION 1
+#define STREAM_HEADER_SIZE 32
+#define CHUNK_HEADER_SIZE 8
+#define CHUNK_ENTRY_SIZE 16
+#define STREAM_FOOTER_SIZE 20
+
+/* Pixel formats a stream can hold */
+#define PIX_FMT_YUV420P 1
+
+/* Size of the compressed input buffer used when streaming */
+#define STREAM_CHUNK 65536
+
+/* Bytes converted and delta coded per step of the fused pass */
+#define FUSE_BYTES 32768
+
+/* Most bytes of pushed frames held to encode groups of pictures in parallel */
+#define PUSH_BATCH_BYTES (1024 * 1024 * 1024)
 
 /* colour conversion constants (ITU-R BT.601) */
 #define YUV_Y_R 0.299f
@@ -22,6 +55,60 @@
 #define YUV_V_G -0.418f
 #define YUV_V_B -0.0813f
 
+/* the same constants in fixed point, scaled by 2^YUV_FIX_SHIFT */
+#define YUV_FIX_SHIFT 15
+#define YUV_FIX_Y_R 9798
+#define YUV_FIX_Y_G 19235
+#define YUV_FIX_Y_B 3736
+#define YUV_FIX_U_R -5538
+#define YUV_FIX_U_G -10846
+#define YUV_FIX_U_B 14713
+#define YUV_FIX_V_R 16351
+#define YUV_FIX_V_G -13697
+#define YUV_FIX_V_B -2664
+#define YUV_FIX_HALF (1 << (YUV_FIX_SHIFT - 1))
+#define YUV_FIX_UV_OFFSET ((128 << YUV_FIX_SHIFT) + YUV_FIX_HALF)
+#define YUV_FIX_Y(r, g, b) ((YUV_FIX_Y_R * (r) + YUV_FIX_Y_G * (g) + YUV_FIX_Y_B * (b) + YUV_FIX_HALF) >> YUV_FIX_SHIFT)
+#define YUV_FIX_U(r, g, b) ((YUV_FIX_U_R * (r) + YUV_FIX_U_G * (g) + YUV_FIX_U_B * (b) + YUV_FIX_UV_OFFSET) >> YUV_FIX_SHIFT)
+#define YUV_FIX_V(r, g, b) ((YUV_FIX_V_R * (r) + YUV_FIX_V_G * (g) + YUV_FIX_V_B * (b) + YUV_FIX_UV_OFFSET) >> YUV_FIX_SHIFT)
+
+/* YUV to RGB, the constants the backend decoder uses */
+#define RGB_R_V 1.402f
+#define RGB_G_U 0.344f
+#define RGB_G_V 0.714f
+#define RGB_B_U 1.772f
+
+/* the same in fixed point, scaled by 2^RGB_FIX_SHIFT; u and v are centred on 0 */
+#define RGB_FIX_SHIFT 14
+#define RGB_FIX_R_V 22970
+#define RGB_FIX_G_U -5636
+#define RGB_FIX_G_V -11698
+#define RGB_FIX_B_U 29032
+#define RGB_FIX_R(u, v) ((RGB_FIX_R_V * (v)) >> RGB_FIX_SHIFT)
+#define RGB_FIX_G(u, v) ((RGB_FIX_G_U * (u) + RGB_FIX_G_V * (v)) >> RGB_FIX_SHIFT)
+#define RGB_FIX_B(u, v) ((RGB_FIX_B_U * (u)) >> RGB_FIX_SHIFT)
+
+/* decoder output formats */
+typedef enum {
+	OUTPUT_RGB24,
+	OUTPUT_YUV420P,
+	OUTPUT_NV12
+} output_format;
+
+/* encoder input formats */
+typedef enum {
+	INPUT_RGB24,	/* raw packed RGB24 */
+	INPUT_YUV420P,	/* raw planar YUV420, fed to the delta stage as is */
+	INPUT_Y4M	/* YUV4MPEG2 stream of 4:2:0 frames, sized by its header */
+} input_format;
+
+/* colour conversion implementations */
+typedef enum {
+	COLOUR_FLOAT,	/* float reference */
+	COLOUR_FIXED,	/* scalar fixed point */
+	COLOUR_SIMD	/* fixed point, vectorised when the CPU allows */
+} colour_path;
+
 /**
  * @struct video_frame
  * @brief Structure to old frame data and metadata
@@ -34,6 +121,94 @@ typedef struct {
 	size_t size;
 } video_frame;
 
+/* vector instruction sets, in order of width */
+typedef enum {
+	SIMD_NONE,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_AVX512
+} simd_level;
+
+/* one task of a batch run on a thread_pool */
+typedef void (*pool_task)(void *arg, int index);
+
+/**
+ * @struct thread_pool
+ * @brief: Worker threads running batches of indexed tasks
+ *
+ * @param threads: Worker thread handles
+ * @param count: Number of worker threads
+ * @param lock: Protects the fields below
+ * @param work: Signalled when a new batch is posted or on stop
+ * @param done: Signalled when the last task of a batch finishes
+ * @param task: Task function of the current batch
+ * @param arg: Task argument of the current batch
+ * @param next: Index of the next task to hand out
+ * @param total: Number of tasks in the current batch
+ * @param pending: Tasks of the current batch not yet finished
+ * @param batch: Batch counter, so workers can tell new work from old
+ * @param stop: Set to shut the workers down
+ */
+typedef struct {
+	pthread_t *threads;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pool_task task;
+	void *arg;
+	int next;
+	int total;
+	int pending;
+	unsigned int batch;
+	int stop;
+} thread_pool;
+
+/**
+ * @struct frame_arena
+ * @brief: Recycled frame buffers of one size, carved from large blocks
+ *
+ * @param slot_size: Size of every buffer, a multiple of FRAME_ALIGN
+ * @param free_list: Buffers ready to hand out, linked through their first bytes
+ * @param free_count: Number of buffers on @free_list
+ * @param blocks: Blocks the buffers were carved from, linked through a
+ * header in front of each block
+ * @param slots: Number of buffers carved so far
+ */
+typedef struct {
+	size_t slot_size;
+	void *free_list;
+	int free_count;
+	void *blocks;
+	int slots;
+} frame_arena;
+
+/**
+ * @struct yuv_frame
+ * @brief: Where the planes of one YUV420 frame are in memory
+ *
+ * Frames in a stream and in raw files are packed, each plane straight
+ * after the one before with no gap between rows. Padded frames start
+ * every row of every plane on a FRAME_ALIGN boundary and may keep a
+ * border around each plane, e.g. for motion search.
+ *
+ * @param data: Buffer holding the planes
+ * @param plane: First visible sample of Y, U and V
+ * @param stride: Bytes from one row of each plane to the next
+ * @param width: Visible samples per row of each plane
+ * @param height: Visible rows of each plane
+ * @param border: Samples of border on every side of the Y plane, U and
+ * V have half as many, rounded up
+ */
+typedef struct {
+	unsigned char *data;
+	unsigned char *plane[3];
+	int stride[3];
+	int width[3];
+	int height[3];
+	int border;
+} yuv_frame;
+
 /**
  * @struct encoder_context
  * @brief: Structure to hold encoder state and configs
@@ -42,20 +217,312 @@ typedef struct {
  * @param height: Video height in pixels
  * @param frame_size: Size of one frame in bytes
  * @param yuv_size: SIze of YUV frame in bytes
+ * @param chroma_width: Width of the U and V planes, half the width rounded up
+ * @param chroma_height: Height of the U and V planes, half the height rounded up
+ * @param input_file: Source video, for ffmpeg input
+ * @param output_file: Encoded output filename
+ * @param target_width: Width ffmpeg scales the source to
+ * @param target_height: Height ffmpeg scales the source to
+ * @param fps: Target frame rate, 0 to keep the source rate
+ * @param gop_size: Frames per group of pictures, each group starts with a
+ * key frame coded without reference to earlier frames and is compressed
+ * as a chunk of its own
+ * @param colour: Colour conversion implementation, both ways
+ * @param yuv_kernel: Conversion function picked for @colour, converts
+ * rows row_start..row_end-1 where row_start is even
+ * @param rgb_kernel: YUV to RGB conversion picked for @colour, converts
+ * rows row_start..row_end-1
+ * @param threads: Number of threads used for colour conversion and
+ * compression
+ * @param pool: Worker pool when @threads is more than 1, else NULL
+ * @param arena: RGB24 frame buffers
+ * @param yuv_arena: YUV420 frame buffers, packed or padded without border
  */
-typedef struct {
+typedef struct encoder_context {
 	int width;
 	int height;
 	size_t frame_size;
 	size_t yuv_size;
+	int chroma_width;
+	int chroma_height;
+	char input_file[256];
+	char output_file[256];
+	int target_width;
+	int target_height;
+	float fps;
+	int gop_size;
+	colour_path colour;
+	void (*yuv_kernel)(struct encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+	void (*rgb_kernel)(struct encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+	int threads;
+	thread_pool *pool;
+	frame_arena arena;
+	frame_arena yuv_arena;
 } encoder_context;
 
+/**
+ * @struct frame_source
+ * @brief: Where raw frames are read from
+ *
+ * @param format: Layout of the frames in the input
+ * @param frame_bytes: Size of one frame in the input, without any Y4M frame header
+ * @param fp: Input stream, used when the file is not mapped
+ * @param is_pipe: Non zero when @fp was opened with popen()
+ * @param buffer: One frame buffer filled from @fp
+ * @param map: Memory mapped input file, or NULL
+ * @param map_size: Length of the mapping in bytes
+ * @param offset: Offset of the next frame in the mapping
+ * @param released: Offset up to which mapped pages have been dropped
+ * @param hold: Non zero while frames already returned are in use, so none are dropped
+ * @param error: Non zero once malformed input has been found
+ */
+typedef struct {
+	input_format format;
+	size_t frame_bytes;
+	FILE *fp;
+	int is_pipe;
+	unsigned char *buffer;
+	unsigned char *map;
+	size_t map_size;
+	size_t offset;
+	size_t released;
+	int hold;
+	int error;
+} frame_source;
+
+/**
+ * @struct stream_header
+ * @brief: Parameters written ahead of the compressed frames
+ *
+ * @param version: Container version, STREAM_VERSION
+ * @param header_size: Bytes before the first chunk
+ * @param width: Video width in pixels
+ * @param height: Video height in pixels
+ * @param fps_num: Frame rate numerator
+ * @param fps_den: Frame rate denominator
+ * @param gop_size: Key frame interval, see encoder_context
+ * @param pix_fmt: Layout of the decoded frames, PIX_FMT_YUV420P
+ */
+typedef struct {
+	int version;
+	int header_size;
+	int width;
+	int height;
+	unsigned int fps_num;
+	unsigned int fps_den;
+	int gop_size;
+	int pix_fmt;
+} stream_header;
+
+/**
+ * @struct stream_footer
+ * @brief: Written after the chunk index, at the very end of the file
+ *
+ * @param index_offset: File offset of the chunk index
+ * @param chunk_count: Number of chunks, and of index entries
+ * @param frame_count: Number of frames in the stream
+ */
+typedef struct {
+	uint64_t index_offset;
+	int chunk_count;
+	int frame_count;
+} stream_footer;
+
+/**
+ * @struct chunk_entry
+ * @brief: Chunk index entry
+ *
+ * @param offset: File offset of the chunk header
+ * @param first_frame: Number of the key frame the chunk starts with
+ * @param frames: Number of frames in the chunk
+ */
+typedef struct {
+	uint64_t offset;
+	int first_frame;
+	int frames;
+} chunk_entry;
+
+/**
+ * @struct chunk_header
+ * @brief: Written ahead of every compressed chunk
+ *
+ * @param size: Compressed size of the chunk in bytes
+ * @param frames: Number of frames in the chunk, the first is a key frame
+ */
+typedef struct {
+	unsigned int size;
+	unsigned int frames;
+} chunk_header;
+
+/**
+ * @struct gop_chunk
+ * @brief: One group of pictures being encoded
+ *
+ * @param strm: Deflate stream, fed each residual as soon as it is made
+ * @param strm_open: Non zero once @strm needs deflateEnd()
+ * @param ref: Previous frame, the reference for the next delta, padded
+ * @param cur: Frame being encoded, padded
+ * @param band: Residual of one band of rows on its way to @strm
+ * @param input: Frames to encode when the group is run on the worker pool
+ * @param pending: Number of frames in @input
+ * @param frames: Number of frames compressed so far, gop_size at most
+ * @param data: Compressed chunk
+ * @param size: Bytes used in @data
+ * @param capacity: Size of @data, grown as the chunk is compressed
+ * @param status: 0 once compressed, -1 if encoding failed
+ */
+typedef struct {
+	z_stream strm;
+	int strm_open;
+	yuv_frame ref;
+	yuv_frame cur;
+	unsigned char *band;
+	const unsigned char **input;
+	int pending;
+	int frames;
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+	int status;
+} gop_chunk;
+
+/**
+ * @struct stream_decoder
+ * @brief: State of a pull style, frame at a time decoder
+ *
+ * @param ctx: Encoder context
+ * @param in: Encoded stream
+ * @param hdr: Stream header
+ * @param strm: Inflate stream, reset at the start of every chunk
+ * @param strm_open: Non zero once @strm needs inflateEnd()
+ * @param in_buf: Compressed input buffer of STREAM_CHUNK bytes
+ * @param frame: Last frame decoded, the reference for the next delta
+ * @param delta: Inflated slice of a delta, FUSE_BYTES bytes
+ * @param chunk_bytes: Compressed bytes of the current chunk not read yet
+ * @param frames_left: Frames of the current chunk not decoded yet
+ * @param frame_count: Frames decoded so far
+ * @param error: Set when decoding stopped on a failure
+ */
+typedef struct {
+	encoder_context *ctx;
+	FILE *in;
+	stream_header hdr;
+	z_stream strm;
+	int strm_open;
+	unsigned char *in_buf;
+	unsigned char *frame;
+	unsigned char *delta;
+	size_t chunk_bytes;
+	int frames_left;
+	int frame_count;
+	int error;
+} stream_decoder;
+
+/**
+ * @struct stream_encoder
+ * @brief: State of a one pass, frame at a time encoder
+ *
+ * @param ctx: Encoder context
+ * @param out: Output stream for the compressed data
+ * @param chunks: Chunks in flight, one per thread, the first streams pushed frames when @batch_frames is 0
+ * @param chunk_count: Number of @chunks
+ * @param open_chunks: Number of @chunks with their frames and stream set up
+ * @param src: Mapped source of the frames in @input, NULL for pushed frames
+ * @param input: Frames of a batch of groups encoded on the worker pool
+ * @param queue: Pushed frames, packed YUV420, held until a batch is full
+ * @param batch_frames: Size of @queue, 0 when pushed frames go straight to the first chunk
+ * @param queued: Frames in @queue
+ * @param offset: Bytes written to @out so far
+ * @param index: Entry of every chunk written
+ * @param index_size: Allocated entries in @index
+ * @param footer: Chunks and frames written so far
+ * @param band_rows: Rows converted per step of the fused pass
+ * @param frame_count: Frames encoded so far
+ */
+typedef struct {
+	encoder_context *ctx;
+	FILE *out;
+	gop_chunk *chunks;
+	int chunk_count;
+	int open_chunks;
+	frame_source *src;
+	const unsigned char **input;
+	unsigned char **queue;
+	int batch_frames;
+	int queued;
+	uint64_t offset;
+	chunk_entry *index;
+	int index_size;
+	stream_footer footer;
+	int band_rows;
+	int frame_count;
+} stream_encoder;
+
+int check_frame_size(int width, int height);
 void init_encoder(encoder_context *ctx, int width, int height);
+void set_colour_path(encoder_context *ctx, colour_path path);
+int set_threads(encoder_context *ctx, int threads);
+void free_encoder(encoder_context *ctx);
+void arena_init(frame_arena *arena, size_t size);
+int arena_reserve(frame_arena *arena, int count);
+unsigned char *arena_alloc(frame_arena *arena);
+void arena_free(frame_arena *arena, void *buf);
+void arena_destroy(frame_arena *arena);
+thread_pool *pool_create(int threads);
+void pool_run(thread_pool *pool, pool_task task, void *arg, int count);
+void pool_destroy(thread_pool *pool);
 int read_frames(encoder_context *ctx, const char *filename, video_frame **frames, int *frame_count);
-void convert_to_yuv420(encoder_context *ctx, video_frame *frame);
+int read_frame(encoder_context *ctx, FILE *fp, unsigned char *rgb);
+void init_packed_frame(encoder_context *ctx, const unsigned char *data, yuv_frame *frame);
+size_t padded_frame_size(encoder_context *ctx, int border);
+void init_padded_frame(encoder_context *ctx, unsigned char *data, int border, yuv_frame *frame);
+void copy_frame_planes(yuv_frame *dst, const yuv_frame *src);
+void extend_frame_border(yuv_frame *frame);
+void rgb_to_yuv420(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv);
+void rgb_to_yuv420_float(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+void rgb_to_yuv420_fixed(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+void rgb_to_yuv420_sse41(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+void rgb_to_yuv420_avx2(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end);
+void yuv420_to_rgb(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb);
+void yuv420_to_rgb_float(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+void yuv420_to_rgb_fixed(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+void yuv420_to_rgb_sse41(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+void yuv420_to_rgb_avx2(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end);
+void yuv420_to_nv12(encoder_context *ctx, const yuv_frame *yuv, unsigned char *nv12);
+int cpu_has_sse41(void);
+int cpu_has_avx2(void);
+int convert_to_yuv420(encoder_context *ctx, video_frame *frame);
+simd_level select_delta_kernels(simd_level max);
+void subtract_frame(unsigned char *delta, const unsigned char *cur, const unsigned char *prev, size_t size);
+void add_frame(unsigned char *frame, const unsigned char *delta, const unsigned char *prev, size_t size);
 void create_delta_frames(video_frame *frames, int frame_count);
+int open_source(encoder_context *ctx, frame_source *src, const char *filename, input_format format, int use_mmap);
+int open_pipe_source(encoder_context *ctx, frame_source *src, const char *command, input_format format);
+const unsigned char *source_next_frame(frame_source *src);
+void source_release_frame(frame_source *src, const unsigned char *frame);
+int close_source(frame_source *src);
+int write_stream_header(FILE *fp, encoder_context *ctx);
+int parse_stream_header(const unsigned char *buf, stream_header *hdr);
+int write_chunk_header(FILE *fp, const chunk_header *hdr);
+void parse_chunk_header(const unsigned char *buf, chunk_header *hdr);
+int write_stream_index(FILE *fp, const chunk_entry *index, const stream_footer *ftr);
+int parse_stream_footer(const unsigned char *buf, uint64_t file_size, stream_footer *ftr);
+int parse_stream_index(const unsigned char *buf, const stream_footer *ftr, chunk_entry *index);
+int read_stream_index(FILE *fp, stream_header *hdr, stream_footer *ftr, chunk_entry **index);
+int find_chunk(const chunk_entry *index, int count, int frame);
+int stream_encoder_init(stream_encoder *enc, encoder_context *ctx, FILE *out);
+int stream_encode_frame(stream_encoder *enc, const unsigned char *rgb);
+int stream_encode_yuv_frame(stream_encoder *enc, const yuv_frame *yuv);
+int stream_encoder_finish(stream_encoder *enc);
+void stream_encoder_free(stream_encoder *enc);
+int encode_stream(encoder_context *ctx, frame_source *src, FILE *out, int *frame_count);
 unsigned char *compressed_frames(video_frame *frames, int frame_count, size_t *compressed_size);
-void decode_frames(encoder_context *ctx, unsigned char *compressed_data, size_t compressed_size, video_frame *frames, int frame_count);
+int decode_frames(encoder_context *ctx, unsigned char *compressed_data, size_t compressed_size, int first_frame, video_frame *frames, int frame_count);
+int decode_range(encoder_context *ctx, FILE *fp, int first_frame, int count, video_frame *frames);
+int stream_decoder_init(stream_decoder *dec, encoder_context *ctx, FILE *in);
+const unsigned char *decoder_next_frame(stream_decoder *dec);
+int stream_decoder_seek(stream_decoder *dec, int frame);
+void stream_decoder_free(stream_decoder *dec);
 float clamp(float x, float min, float max);
 
 #endif /* CODEC_H */
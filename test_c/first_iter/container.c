@@ -0,0 +1,302 @@
+// container.c
+#include "codec.h"
+
+/*
+ * Container layout, every field little endian:
+ *
+ *   header   "VCDC", u16 version, u16 header size, u32 width, u32 height,
+ *            u32 fps numerator, u32 fps denominator, u32 GOP size,
+ *            u8 pixel format, 3 bytes reserved
+ *   chunks   u32 compressed size, u32 frame count, zlib stream; the first
+ *            frame of a chunk is a key frame, the rest are deltas
+ *   index    per chunk: u64 offset of its header, u32 first frame,
+ *            u32 frame count
+ *   footer   u64 index offset, u32 chunk count, u32 frame count, "VEND"
+ *
+ * The index and footer go after the last chunk, so the file is written in
+ * one pass without seeking back. A reader that can seek starts from the
+ * footer; one that cannot walks the chunks from the header. The index
+ * starts with the offset of the first chunk, or of the index itself when
+ * there are no chunks, which is below 4 GiB and so reads as a chunk header
+ * with no frames: that marks the end of the chunks.
+ */
+
+static void put_le16(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static unsigned int get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/**
+ * write_stream_header - Write the container header
+ * @fp: Output stream, positioned at the start of the file
+ * @ctx: Encoder context
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int write_stream_header(FILE *fp, encoder_context *ctx)
+{
+    unsigned char buf[STREAM_HEADER_SIZE] = {0};
+
+    memcpy(buf, STREAM_MAGIC, 4);
+    put_le16(buf + 4, STREAM_VERSION);
+    put_le16(buf + 6, STREAM_HEADER_SIZE);
+    put_le32(buf + 8, ctx->width);
+    put_le32(buf + 12, ctx->height);
+    /* frame rate to a thousandth of a frame */
+    put_le32(buf + 16, (uint32_t)(ctx->fps * 1000 + 0.5f));
+    put_le32(buf + 20, 1000);
+    put_le32(buf + 24, ctx->gop_size);
+    buf[28] = PIX_FMT_YUV420P;
+
+    return fwrite(buf, sizeof(buf), 1, fp) == 1 ? 0 : -1;
+}
+
+/**
+ * parse_stream_header - Decode and check a container header
+ * @buf: First STREAM_HEADER_SIZE bytes of the file
+ * @hdr: Header to fill in
+ *
+ * Return: 0 on success, -1 if this is not a stream this code can read
+ */
+int parse_stream_header(const unsigned char *buf, stream_header *hdr)
+{
+    if (memcmp(buf, STREAM_MAGIC, 4) != 0) {
+        fprintf(stderr, "Not an encoded video stream\n");
+        return -1;
+    }
+
+    hdr->version = get_le16(buf + 4);
+    hdr->header_size = get_le16(buf + 6);
+    if (hdr->version != STREAM_VERSION || hdr->header_size < STREAM_HEADER_SIZE) {
+        fprintf(stderr, "Unsupported stream version %d\n", hdr->version);
+        return -1;
+    }
+
+    hdr->width = get_le32(buf + 8);
+    hdr->height = get_le32(buf + 12);
+    hdr->fps_num = get_le32(buf + 16);
+    hdr->fps_den = get_le32(buf + 20);
+    hdr->gop_size = get_le32(buf + 24);
+    hdr->pix_fmt = buf[28];
+    if (hdr->pix_fmt != PIX_FMT_YUV420P) {
+        fprintf(stderr, "Invalid stream header\n");
+        return -1;
+    }
+    /* the frame buffers are sized from these, so they are checked before use */
+    if (check_frame_size(hdr->width, hdr->height) != 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * write_chunk_header - Write the header ahead of a compressed chunk
+ * @fp: Output stream
+ * @hdr: Chunk header
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int write_chunk_header(FILE *fp, const chunk_header *hdr)
+{
+    unsigned char buf[CHUNK_HEADER_SIZE];
+
+    put_le32(buf, hdr->size);
+    put_le32(buf + 4, hdr->frames);
+
+    return fwrite(buf, sizeof(buf), 1, fp) == 1 ? 0 : -1;
+}
+
+/**
+ * parse_chunk_header - Decode a chunk header
+ * @buf: CHUNK_HEADER_SIZE bytes
+ * @hdr: Chunk header to fill in
+ */
+void parse_chunk_header(const unsigned char *buf, chunk_header *hdr)
+{
+    hdr->size = get_le32(buf);
+    hdr->frames = get_le32(buf + 4);
+}
+
+/**
+ * write_stream_index - Write the chunk index and the footer
+ * @fp: Output stream, just after the last chunk
+ * @index: One entry per chunk
+ * @ftr: Footer, index_offset is where @fp is now
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int write_stream_index(FILE *fp, const chunk_entry *index, const stream_footer *ftr)
+{
+    unsigned char buf[CHUNK_ENTRY_SIZE > STREAM_FOOTER_SIZE ? CHUNK_ENTRY_SIZE : STREAM_FOOTER_SIZE];
+
+    for (int i = 0; i < ftr->chunk_count; i++) {
+        put_le64(buf, index[i].offset);
+        put_le32(buf + 8, index[i].first_frame);
+        put_le32(buf + 12, index[i].frames);
+        if (fwrite(buf, CHUNK_ENTRY_SIZE, 1, fp) != 1)
+            return -1;
+    }
+
+    put_le64(buf, ftr->index_offset);
+    put_le32(buf + 8, ftr->chunk_count);
+    put_le32(buf + 12, ftr->frame_count);
+    memcpy(buf + 16, STREAM_FOOTER_MAGIC, 4);
+
+    return fwrite(buf, STREAM_FOOTER_SIZE, 1, fp) == 1 ? 0 : -1;
+}
+
+/**
+ * parse_stream_footer - Decode the footer at the end of a file
+ * @buf: Last STREAM_FOOTER_SIZE bytes of the file
+ * @file_size: Size of the whole file
+ * @ftr: Footer to fill in
+ *
+ * Return: 0 on success, -1 if there is no valid footer, e.g. when the
+ * encoder did not finish
+ */
+int parse_stream_footer(const unsigned char *buf, uint64_t file_size, stream_footer *ftr)
+{
+    if (memcmp(buf + 16, STREAM_FOOTER_MAGIC, 4) != 0)
+        return -1;
+
+    ftr->index_offset = get_le64(buf);
+    ftr->chunk_count = get_le32(buf + 8);
+    ftr->frame_count = get_le32(buf + 12);
+    if (ftr->chunk_count < 0 || ftr->frame_count < 0 ||
+        ftr->index_offset < STREAM_HEADER_SIZE ||
+        ftr->index_offset + (uint64_t)ftr->chunk_count * CHUNK_ENTRY_SIZE + STREAM_FOOTER_SIZE != file_size)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * parse_stream_index - Decode the chunk index
+ * @buf: ftr->chunk_count entries of CHUNK_ENTRY_SIZE bytes
+ * @ftr: Footer of the same file
+ * @index: Array of ftr->chunk_count entries to fill in
+ *
+ * Return: 0 on success, -1 if the entries are out of order, overlap the
+ * index or do not add up to the footer's frame count
+ */
+int parse_stream_index(const unsigned char *buf, const stream_footer *ftr, chunk_entry *index)
+{
+    /* wide enough that a crafted frame count can not wrap it */
+    uint64_t first = 0;
+    uint64_t next = STREAM_HEADER_SIZE;
+
+    for (int i = 0; i < ftr->chunk_count; i++, buf += CHUNK_ENTRY_SIZE) {
+        index[i].offset = get_le64(buf);
+        index[i].first_frame = get_le32(buf + 8);
+        index[i].frames = get_le32(buf + 12);
+
+        /* chunks follow each other in order and cover every frame once */
+        if (index[i].first_frame < 0 || (uint64_t)index[i].first_frame != first || index[i].frames <= 0 ||
+            index[i].offset < next || index[i].offset > ftr->index_offset - CHUNK_HEADER_SIZE)
+            return -1;
+        first += index[i].frames;
+        next = index[i].offset + CHUNK_HEADER_SIZE;
+    }
+
+    return first == (uint64_t)ftr->frame_count ? 0 : -1;
+}
+
+/**
+ * read_stream_index - Read the header and chunk index of an encoded file
+ * @fp: Encoded file, must be seekable
+ * @hdr: Header to fill in
+ * @ftr: Footer to fill in
+ * @index: Set to a malloc'd array of ftr->chunk_count entries
+ *
+ * Only the header, the footer and the index are read, so this costs the
+ * same whatever the length of the video.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int read_stream_index(FILE *fp, stream_header *hdr, stream_footer *ftr, chunk_entry **index)
+{
+    unsigned char buf[STREAM_HEADER_SIZE > STREAM_FOOTER_SIZE ? STREAM_HEADER_SIZE : STREAM_FOOTER_SIZE];
+    unsigned char *entries;
+    off_t size;
+
+    *index = NULL;
+
+    if (fseeko(fp, 0, SEEK_SET) != 0 || fread(buf, STREAM_HEADER_SIZE, 1, fp) != 1 ||
+        parse_stream_header(buf, hdr) != 0)
+        return -1;
+
+    if (fseeko(fp, 0, SEEK_END) != 0 || (size = ftello(fp)) < hdr->header_size + STREAM_FOOTER_SIZE ||
+        fseeko(fp, size - STREAM_FOOTER_SIZE, SEEK_SET) != 0 || fread(buf, STREAM_FOOTER_SIZE, 1, fp) != 1 ||
+        parse_stream_footer(buf, size, ftr) != 0) {
+        fprintf(stderr, "Stream has no chunk index\n");
+        return -1;
+    }
+
+    entries = malloc((size_t)ftr->chunk_count * CHUNK_ENTRY_SIZE + 1);
+    *index = malloc((ftr->chunk_count + 1) * sizeof(**index));
+    if (!entries || !*index || fseeko(fp, ftr->index_offset, SEEK_SET) != 0 ||
+        fread(entries, CHUNK_ENTRY_SIZE, ftr->chunk_count, fp) != (size_t)ftr->chunk_count ||
+        parse_stream_index(entries, ftr, *index) != 0) {
+        fprintf(stderr, "Invalid chunk index\n");
+        free(entries);
+        free(*index);
+        *index = NULL;
+        return -1;
+    }
+
+    free(entries);
+
+    return 0;
+}
+
+/**
+ * find_chunk - Find the chunk holding a frame
+ * @index: Chunk index, in frame order
+ * @count: Number of chunks
+ * @frame: Frame number
+ *
+ * Return: Index of the chunk
+ */
+int find_chunk(const chunk_entry *index, int count, int frame)
+{
+    int lo = 0, hi = count - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+
+        if (index[mid].first_frame <= frame)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
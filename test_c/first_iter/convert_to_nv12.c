@@ -0,0 +1,55 @@
+// convert_to_nv12.c
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * interleave_uv - Interleave a row of U and V samples
+ * @u: U samples
+ * @v: V samples
+ * @uv: Output, 2 * @count bytes
+ * @count: Number of samples in each of @u and @v
+ */
+static void interleave_uv(const unsigned char *u, const unsigned char *v, unsigned char *uv, size_t count)
+{
+    size_t j = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    /* SSE2 is part of x86-64, so no target attribute is needed for it */
+    for (; j + 16 <= count; j += 16) {
+        __m128i uu = _mm_loadu_si128((const __m128i *)(u + j));
+        __m128i vv = _mm_loadu_si128((const __m128i *)(v + j));
+
+        _mm_storeu_si128((__m128i *)(uv + 2*j), _mm_unpacklo_epi8(uu, vv));
+        _mm_storeu_si128((__m128i *)(uv + 2*j + 16), _mm_unpackhi_epi8(uu, vv));
+    }
+#endif
+
+    for (; j < count; j++) {
+        uv[2*j] = u[j];
+        uv[2*j + 1] = v[j];
+    }
+}
+
+/**
+ * yuv420_to_nv12 - Convert a planar YUV420 frame to NV12
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame, packed or padded
+ * @nv12: Output buffer, ctx->yuv_size bytes
+ *
+ * NV12 keeps the Y plane and follows it with one plane of interleaved U
+ * and V samples, the layout most hardware video paths take.
+ */
+void yuv420_to_nv12(encoder_context *ctx, const yuv_frame *yuv, unsigned char *nv12)
+{
+    unsigned char *uv = nv12 + (size_t)ctx->width * ctx->height;
+
+    for (int i = 0; i < ctx->height; i++)
+        memcpy(nv12 + (size_t)i * ctx->width, yuv->plane[0] + (size_t)i * yuv->stride[0], ctx->width);
+
+    for (int i = 0; i < ctx->chroma_height; i++)
+        interleave_uv(yuv->plane[1] + (size_t)i * yuv->stride[1], yuv->plane[2] + (size_t)i * yuv->stride[2],
+                      uv + (size_t)i * 2 * ctx->chroma_width, ctx->chroma_width);
+}
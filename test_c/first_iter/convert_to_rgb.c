@@ -0,0 +1,134 @@
+// convert_to_rgb.c
+#include "codec.h"
+
+/* shared by every band of a yuv420_to_rgb() call */
+typedef struct {
+    encoder_context *ctx;
+    const yuv_frame *yuv;
+    unsigned char *rgb;
+    int band_rows;
+} rgb_job;
+
+/**
+ * clamp_byte - Clamp an integer to 0..255
+ * @x: Value to clamp
+ *
+ * Return: Clamped value
+ */
+static inline unsigned char clamp_byte(int x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/**
+ * yuv420_to_rgb_fixed - Fixed point YUV420 to RGB24 conversion
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame
+ * @rgb: Output buffer, ctx->frame_size bytes
+ * @row_start: First row to convert
+ * @row_end: Row after the last one to convert
+ *
+ * Each chroma sample covers a 2x2 block of pixels, cut short by a
+ * trailing odd row or column.
+ */
+void yuv420_to_rgb_fixed(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    int width = ctx->width;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        const unsigned char *u_row = yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        const unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+        unsigned char *p = rgb + (size_t)i * width * 3;
+
+        for (int j = 0; j < width; j++)
+        {
+            int u = u_row[j/2] - 128;
+            int v = v_row[j/2] - 128;
+
+            p[3*j] = clamp_byte(y_row[j] + RGB_FIX_R(u, v));
+            p[3*j + 1] = clamp_byte(y_row[j] + RGB_FIX_G(u, v));
+            p[3*j + 2] = clamp_byte(y_row[j] + RGB_FIX_B(u, v));
+        }
+    }
+}
+
+/**
+ * yuv420_to_rgb_float - Floating point YUV420 to RGB24 conversion
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame
+ * @rgb: Output buffer, ctx->frame_size bytes
+ * @row_start: First row to convert
+ * @row_end: Row after the last one to convert
+ *
+ * Same arithmetic as VideoEncoder.yuv420_to_rgb() in the backend
+ */
+void yuv420_to_rgb_float(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    int width = ctx->width;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        const unsigned char *u_row = yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        const unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+        unsigned char *p = rgb + (size_t)i * width * 3;
+
+        for (int j = 0; j < width; j++)
+        {
+            float y = y_row[j];
+            float u = u_row[j/2] - 128.0f;
+            float v = v_row[j/2] - 128.0f;
+
+            p[3*j] = clamp(y + RGB_R_V * v, 0, 255);
+            p[3*j + 1] = clamp(y - RGB_G_U * u - RGB_G_V * v, 0, 255);
+            p[3*j + 2] = clamp(y + RGB_B_U * u, 0, 255);
+        }
+    }
+}
+
+/**
+ * convert_rgb_band - Convert one band of rows, run on the worker pool
+ * @arg: Conversion job
+ * @index: Band number
+ */
+static void convert_rgb_band(void *arg, int index)
+{
+    rgb_job *job = arg;
+    int start = index * job->band_rows;
+    int end = start + job->band_rows;
+
+    if (end > job->ctx->height)
+        end = job->ctx->height;
+
+    job->ctx->rgb_kernel(job->ctx, job->yuv, job->rgb, start, end);
+}
+
+/**
+ * yuv420_to_rgb - Convert a YUV420 frame to RGB24
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame, packed or padded
+ * @rgb: Output buffer, ctx->frame_size bytes
+ *
+ * Uses the conversion picked by set_colour_path(), split into one band of
+ * rows per thread when there is a worker pool.
+ */
+void yuv420_to_rgb(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb)
+{
+    rgb_job job;
+    int bands;
+
+    if (!ctx->pool) {
+        ctx->rgb_kernel(ctx, yuv, rgb, 0, ctx->height);
+        return;
+    }
+
+    job.ctx = ctx;
+    job.yuv = yuv;
+    job.rgb = rgb;
+    job.band_rows = (ctx->height + ctx->threads - 1) / ctx->threads;
+    bands = (ctx->height + job.band_rows - 1) / job.band_rows;
+
+    pool_run(ctx->pool, convert_rgb_band, &job, bands);
+}
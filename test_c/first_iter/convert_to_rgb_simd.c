@@ -0,0 +1,247 @@
+// convert_to_rgb_simd.c
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* two 16 bit madd coefficients packed into one 32 bit lane */
+#define COEF_PAIR(a, b) ((int)(((unsigned int)(unsigned short)(b) << 16) | (unsigned short)(a)))
+
+/* pshufb masks spreading 16 R, G and B values over 48 bytes of RGB24 */
+#define SHUF_OUT0_R  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5
+#define SHUF_OUT0_G -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1
+#define SHUF_OUT0_B -1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1
+#define SHUF_OUT1_R -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1
+#define SHUF_OUT1_G  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10
+#define SHUF_OUT1_B -1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1
+#define SHUF_OUT2_R -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1
+#define SHUF_OUT2_G -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1
+#define SHUF_OUT2_B 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15
+
+/**
+ * rgb_row_tail - Scalar conversion for the end of a row
+ * @y_row: Y row
+ * @u_row: U row shared with the neighbouring row
+ * @v_row: V row
+ * @p: RGB24 output row
+ * @from: First pixel to convert
+ * @width: Row width in pixels
+ */
+static void rgb_row_tail(const unsigned char *y_row, const unsigned char *u_row, const unsigned char *v_row,
+                         unsigned char *p, int from, int width)
+{
+    for (int j = from; j < width; j++)
+    {
+        int u = u_row[j/2] - 128, v = v_row[j/2] - 128;
+        int r = y_row[j] + RGB_FIX_R(u, v);
+        int g = y_row[j] + RGB_FIX_G(u, v);
+        int b = y_row[j] + RGB_FIX_B(u, v);
+
+        p[3*j] = r < 0 ? 0 : r > 255 ? 255 : r;
+        p[3*j + 1] = g < 0 ? 0 : g > 255 ? 255 : g;
+        p[3*j + 2] = b < 0 ? 0 : b > 255 ? 255 : b;
+    }
+}
+
+/**
+ * rgb_channel_sse41 - One colour channel of 16 pixels
+ * @ylo: Y of pixels 0-7, 16 bit
+ * @yhi: Y of pixels 8-15, 16 bit
+ * @lo: U and V of chroma samples 0-3, interleaved 16 bit
+ * @hi: U and V of chroma samples 4-7
+ * @coef: Packed U and V coefficients of the channel
+ *
+ * Return: 16 channel values, clamped to 0..255
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i rgb_channel_sse41(__m128i ylo, __m128i yhi, __m128i lo, __m128i hi, __m128i coef)
+{
+    __m128i t = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(lo, coef), RGB_FIX_SHIFT),
+                                _mm_srai_epi32(_mm_madd_epi16(hi, coef), RGB_FIX_SHIFT));
+
+    /* each chroma sample covers two neighbouring pixels */
+    return _mm_packus_epi16(_mm_add_epi16(ylo, _mm_unpacklo_epi16(t, t)),
+                            _mm_add_epi16(yhi, _mm_unpackhi_epi16(t, t)));
+}
+
+/**
+ * rgb_block_sse41 - Convert 16 pixels of one row
+ * @y: 16 Y values
+ * @u: 8 U values
+ * @v: 8 V values
+ * @p: 48 bytes of RGB24 output
+ */
+__attribute__((target("sse4.1")))
+static inline void rgb_block_sse41(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *p)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i uu = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)u)), bias);
+    __m128i vv = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)v)), bias);
+    __m128i lo = _mm_unpacklo_epi16(uu, vv), hi = _mm_unpackhi_epi16(uu, vv);
+    __m128i yy = _mm_loadu_si128((const __m128i *)y);
+    __m128i ylo = _mm_unpacklo_epi8(yy, zero), yhi = _mm_unpackhi_epi8(yy, zero);
+    __m128i R, G, B;
+
+    R = rgb_channel_sse41(ylo, yhi, lo, hi, _mm_set1_epi32(COEF_PAIR(0, RGB_FIX_R_V)));
+    G = rgb_channel_sse41(ylo, yhi, lo, hi, _mm_set1_epi32(COEF_PAIR(RGB_FIX_G_U, RGB_FIX_G_V)));
+    B = rgb_channel_sse41(ylo, yhi, lo, hi, _mm_set1_epi32(COEF_PAIR(RGB_FIX_B_U, 0)));
+
+    _mm_storeu_si128((__m128i *)p,
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, _mm_setr_epi8(SHUF_OUT0_R)),
+                                               _mm_shuffle_epi8(G, _mm_setr_epi8(SHUF_OUT0_G))),
+                                  _mm_shuffle_epi8(B, _mm_setr_epi8(SHUF_OUT0_B))));
+    _mm_storeu_si128((__m128i *)(p + 16),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, _mm_setr_epi8(SHUF_OUT1_R)),
+                                               _mm_shuffle_epi8(G, _mm_setr_epi8(SHUF_OUT1_G))),
+                                  _mm_shuffle_epi8(B, _mm_setr_epi8(SHUF_OUT1_B))));
+    _mm_storeu_si128((__m128i *)(p + 32),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, _mm_setr_epi8(SHUF_OUT2_R)),
+                                               _mm_shuffle_epi8(G, _mm_setr_epi8(SHUF_OUT2_G))),
+                                  _mm_shuffle_epi8(B, _mm_setr_epi8(SHUF_OUT2_B))));
+}
+
+/**
+ * yuv420_to_rgb_sse41 - SSE4.1 fixed point YUV420 to RGB24 conversion
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame
+ * @rgb: Output buffer, ctx->frame_size bytes
+ * @row_start: First row to convert
+ * @row_end: Row after the last one to convert
+ *
+ * Converts 16 pixels at a time, bit identical to yuv420_to_rgb_fixed()
+ */
+__attribute__((target("sse4.1")))
+void yuv420_to_rgb_sse41(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    int width = ctx->width;
+    int blocks = width / 16;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        const unsigned char *u_row = yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        const unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+        unsigned char *p = rgb + (size_t)i * width * 3;
+
+        for (int k = 0; k < blocks; k++)
+            rgb_block_sse41(y_row + 16*k, u_row + 8*k, v_row + 8*k, p + 48*k);
+
+        rgb_row_tail(y_row, u_row, v_row, p, blocks * 16, width);
+    }
+}
+
+/**
+ * rgb_channel_avx2 - One colour channel of 32 pixels
+ * @ylo: Y of pixels 0-7 and 16-23, 16 bit
+ * @yhi: Y of pixels 8-15 and 24-31, 16 bit
+ * @lo: U and V of chroma samples 0-3 and 8-11, interleaved 16 bit
+ * @hi: U and V of chroma samples 4-7 and 12-15
+ * @coef: Packed U and V coefficients of the channel
+ *
+ * Return: 32 channel values, clamped to 0..255, pixels 0-15 in the low lane
+ */
+__attribute__((target("avx2")))
+static inline __m256i rgb_channel_avx2(__m256i ylo, __m256i yhi, __m256i lo, __m256i hi, __m256i coef)
+{
+    __m256i t = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_madd_epi16(lo, coef), RGB_FIX_SHIFT),
+                                   _mm256_srai_epi32(_mm256_madd_epi16(hi, coef), RGB_FIX_SHIFT));
+
+    /* each chroma sample covers two neighbouring pixels */
+    return _mm256_packus_epi16(_mm256_add_epi16(ylo, _mm256_unpacklo_epi16(t, t)),
+                               _mm256_add_epi16(yhi, _mm256_unpackhi_epi16(t, t)));
+}
+
+/**
+ * rgb_block_avx2 - Convert 32 pixels of one row
+ * @y: 32 Y values
+ * @u: 16 U values
+ * @v: 16 V values
+ * @p: 96 bytes of RGB24 output
+ *
+ * Chroma samples 0-7 sit in the low lane and 8-15 in the high lane, which
+ * the in lane unpacks line up with Y of pixels 0-15 and 16-31.
+ */
+__attribute__((target("avx2")))
+static inline void rgb_block_avx2(const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *p)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i bias = _mm256_set1_epi16(128);
+    __m256i uu = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)u)), bias);
+    __m256i vv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)v)), bias);
+    __m256i lo = _mm256_unpacklo_epi16(uu, vv), hi = _mm256_unpackhi_epi16(uu, vv);
+    __m256i yy = _mm256_loadu_si256((const __m256i *)y);
+    __m256i ylo = _mm256_unpacklo_epi8(yy, zero), yhi = _mm256_unpackhi_epi8(yy, zero);
+    __m256i R, G, B, o0, o1, o2;
+
+    R = rgb_channel_avx2(ylo, yhi, lo, hi, _mm256_set1_epi32(COEF_PAIR(0, RGB_FIX_R_V)));
+    G = rgb_channel_avx2(ylo, yhi, lo, hi, _mm256_set1_epi32(COEF_PAIR(RGB_FIX_G_U, RGB_FIX_G_V)));
+    B = rgb_channel_avx2(ylo, yhi, lo, hi, _mm256_set1_epi32(COEF_PAIR(RGB_FIX_B_U, 0)));
+
+    o0 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(R, _mm256_setr_epi8(SHUF_OUT0_R, SHUF_OUT0_R)),
+                                         _mm256_shuffle_epi8(G, _mm256_setr_epi8(SHUF_OUT0_G, SHUF_OUT0_G))),
+                         _mm256_shuffle_epi8(B, _mm256_setr_epi8(SHUF_OUT0_B, SHUF_OUT0_B)));
+    o1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(R, _mm256_setr_epi8(SHUF_OUT1_R, SHUF_OUT1_R)),
+                                         _mm256_shuffle_epi8(G, _mm256_setr_epi8(SHUF_OUT1_G, SHUF_OUT1_G))),
+                         _mm256_shuffle_epi8(B, _mm256_setr_epi8(SHUF_OUT1_B, SHUF_OUT1_B)));
+    o2 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(R, _mm256_setr_epi8(SHUF_OUT2_R, SHUF_OUT2_R)),
+                                         _mm256_shuffle_epi8(G, _mm256_setr_epi8(SHUF_OUT2_G, SHUF_OUT2_G))),
+                         _mm256_shuffle_epi8(B, _mm256_setr_epi8(SHUF_OUT2_B, SHUF_OUT2_B)));
+
+    /* each lane holds 48 bytes of output, low lane first */
+    _mm256_storeu_si256((__m256i *)p, _mm256_permute2x128_si256(o0, o1, 0x20));
+    _mm256_storeu_si256((__m256i *)(p + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+    _mm256_storeu_si256((__m256i *)(p + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+}
+
+/**
+ * yuv420_to_rgb_avx2 - AVX2 fixed point YUV420 to RGB24 conversion
+ * @ctx: Encoder context
+ * @yuv: YUV420 frame
+ * @rgb: Output buffer, ctx->frame_size bytes
+ * @row_start: First row to convert
+ * @row_end: Row after the last one to convert
+ *
+ * Converts 32 pixels at a time, then 16, bit identical to
+ * yuv420_to_rgb_fixed()
+ */
+__attribute__((target("avx2")))
+void yuv420_to_rgb_avx2(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    int width = ctx->width;
+    int blocks = width / 32;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        const unsigned char *u_row = yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        const unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+        unsigned char *p = rgb + (size_t)i * width * 3;
+        int j = blocks * 32;
+
+        for (int k = 0; k < blocks; k++)
+            rgb_block_avx2(y_row + 32*k, u_row + 16*k, v_row + 16*k, p + 96*k);
+
+        if (width - j >= 16)
+        {
+            rgb_block_sse41(y_row + j, u_row + j/2, v_row + j/2, p + 3*j);
+            j += 16;
+        }
+
+        rgb_row_tail(y_row, u_row, v_row, p, j, width);
+    }
+}
+
+#else /* no x86 vector kernels */
+
+void yuv420_to_rgb_sse41(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    yuv420_to_rgb_fixed(ctx, yuv, rgb, row_start, row_end);
+}
+
+void yuv420_to_rgb_avx2(encoder_context *ctx, const yuv_frame *yuv, unsigned char *rgb, int row_start, int row_end)
+{
+    yuv420_to_rgb_fixed(ctx, yuv, rgb, row_start, row_end);
+}
+
+#endif
@@ -2,22 +2,21 @@
 #include "codec.h"
 
 /**
- * convert_to_yuv420 - Convert rgb frame to YUV420 format
+ * rgb_to_yuv420_float - Floating point RGB24 to YUV420 conversion
  * @ctx: Encoder context
- * @frame: Frame to convert
- * 
- * Converts RGB24 to YUV420 format with chroma subsampling
+ * @rgb: RGB24 pixels, ctx->frame_size bytes
+ * @yuv: Output frame
+ * @row_start: First row to convert, even
+ * @row_end: Row after the last one to convert
  */
-void convert_to_yuv420(encoder_context *ctx, video_frame *frame)
+void rgb_to_yuv420_float(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
 {
-    unsigned char *rgb = frame->data;
-    unsigned char *yuv = malloc(ctx->yuv_size);
-    unsigned char *Y = yuv;
-    unsigned char *U = yuv + ctx->width *ctx->height;
-    unsigned char *V = U + (ctx->width * ctx->height / 4);
+    unsigned char *Y = yuv->plane[0];
+    unsigned char *U = yuv->plane[1];
+    unsigned char *V = yuv->plane[2];
 
     /* convert each pixel */
-    for (int i = 0; i < ctx->height; i++)
+    for (int i = row_start; i < row_end; i++)
     {
         for (int j = 0; j < ctx->width; j++)
         {
@@ -28,20 +27,139 @@ void convert_to_yuv420(encoder_context *ctx, video_frame *frame)
 
             /* rgb to yuv conversion */
             float y = YUV_Y_R * r + YUV_Y_G * g + YUV_Y_B * b;
-            Y[i * ctx->width + j] = (unsigned char)clamp(y, 0, 255);
+            Y[(size_t)i * yuv->stride[0] + j] = (unsigned char)clamp(y, 0, 255);
 
-            /* subsample UV in 4:2:0 format */
+            /* subsample UV in 4:2:0 format, a trailing odd row or column samples its one pixel */
             if (i % 2 == 0 && j % 2 == 0)
             {
                 float u = YUV_U_R * r + YUV_U_G * g + YUV_U_B * b + 128;
                 float v = YUV_V_R * r + YUV_V_G * g + YUV_V_B * b + 128;
-                U[(1/2) * (ctx->width/2) + j/2] = (unsigned char)clamp(u, 0, 255);
-                V[(i/2) * (ctx->width/2) + j/2] = (unsigned char)clamp(v, 0, 255);
+                U[(size_t)(i/2) * yuv->stride[1] + j/2] = (unsigned char)clamp(u, 0, 255);
+                V[(size_t)(i/2) * yuv->stride[2] + j/2] = (unsigned char)clamp(v, 0, 255);
             }
         }
     }
+}
+
+/**
+ * @struct colour_job
+ * @brief: One frame split into row bands for the worker pool
+ *
+ * @param ctx: Encoder context
+ * @param rgb: RGB24 input frame
+ * @param yuv: YUV420 output frame
+ * @param band_rows: Rows per band, even so 4:2:0 row pairs stay together
+ */
+typedef struct {
+    encoder_context *ctx;
+    const unsigned char *rgb;
+    const yuv_frame *yuv;
+    int band_rows;
+} colour_job;
+
+/**
+ * convert_band - Pool task converting one row band
+ * @arg: colour_job
+ * @index: Band number
+ */
+static void convert_band(void *arg, int index)
+{
+    colour_job *job = arg;
+    int start = index * job->band_rows;
+    int end = start + job->band_rows;
+
+    if (end > job->ctx->height)
+        end = job->ctx->height;
+
+    job->ctx->yuv_kernel(job->ctx, job->rgb, job->yuv, start, end);
+}
+
+/**
+ * rgb_to_yuv420 - Convert one RGB24 frame into a caller supplied buffer
+ * @ctx: Encoder context
+ * @rgb: RGB24 pixels, ctx->frame_size bytes
+ * @yuv: Output frame, packed or padded
+ *
+ * Writes planar YUV420 (Y, then U, then V) with chroma subsampling using
+ * the conversion picked by set_colour_path(). With more than one thread
+ * the frame is split into one band of rows per thread; the output is the
+ * same as converting it in one go.
+ */
+void rgb_to_yuv420(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv)
+{
+    colour_job job;
+    int bands;
+
+    if (!ctx->pool) {
+        ctx->yuv_kernel(ctx, rgb, yuv, 0, ctx->height);
+        return;
+    }
+
+    job.ctx = ctx;
+    job.rgb = rgb;
+    job.yuv = yuv;
+    job.band_rows = (ctx->height + ctx->threads - 1) / ctx->threads;
+    job.band_rows += job.band_rows % 2;
+    bands = (ctx->height + job.band_rows - 1) / job.band_rows;
+
+    pool_run(ctx->pool, convert_band, &job, bands);
+}
+
+/**
+ * set_colour_path - Select the colour conversion implementation
+ * @ctx: Encoder context
+ * @path: Conversion to use
+ *
+ * Picks the kernels for both RGB to YUV and YUV to RGB. COLOUR_SIMD checks
+ * the CPU once here and picks the widest vector kernels it supports,
+ * falling back to the scalar fixed point code. All fixed point kernels
+ * give bit identical output.
+ */
+void set_colour_path(encoder_context *ctx, colour_path path)
+{
+    ctx->colour = path;
+
+    if (path == COLOUR_FLOAT) {
+        ctx->yuv_kernel = rgb_to_yuv420_float;
+        ctx->rgb_kernel = yuv420_to_rgb_float;
+    } else if (path == COLOUR_SIMD && cpu_has_avx2()) {
+        ctx->yuv_kernel = rgb_to_yuv420_avx2;
+        ctx->rgb_kernel = yuv420_to_rgb_avx2;
+    } else if (path == COLOUR_SIMD && cpu_has_sse41()) {
+        ctx->yuv_kernel = rgb_to_yuv420_sse41;
+        ctx->rgb_kernel = yuv420_to_rgb_sse41;
+    } else {
+        ctx->yuv_kernel = rgb_to_yuv420_fixed;
+        ctx->rgb_kernel = yuv420_to_rgb_fixed;
+    }
+}
+
+/**
+ * convert_to_yuv420 - Convert rgb frame to YUV420 format
+ * @ctx: Encoder context
+ * @frame: Frame to convert
+ *
+ * Converts RGB24 to YUV420 format with chroma subsampling. The frame must
+ * come from ctx->arena, which it is given back to, to be reused for the
+ * next frame; the YUV420 buffer is taken from ctx->yuv_arena.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int convert_to_yuv420(encoder_context *ctx, video_frame *frame)
+{
+    unsigned char *yuv = arena_alloc(&ctx->yuv_arena);
+    yuv_frame planes;
+
+    if (!yuv)
+        return -1;
+
+    init_packed_frame(ctx, yuv, &planes);
+    rgb_to_yuv420(ctx, frame->data, &planes);
+
     /* update frame with yuv data */
-    free(frame->data);
+    arena_free(&ctx->arena, frame->data);
     frame->data = yuv;
     frame->size = ctx->yuv_size;
+
+    return 0;
 }
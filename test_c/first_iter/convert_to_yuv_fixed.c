@@ -0,0 +1,42 @@
+// convert_to_yuv_fixed.c
+#include "codec.h"
+
+/**
+ * rgb_to_yuv420_fixed - Fixed point RGB24 to YUV420 conversion
+ * @ctx: Encoder context
+ * @rgb: RGB24 pixels, ctx->frame_size bytes
+ * @yuv: Output frame
+ * @row_start: First row to convert, even
+ * @row_end: Row after the last one to convert
+ *
+ * Uses the BT.601 constants scaled by 2^YUV_FIX_SHIFT with rounding. The
+ * scaled constants keep every result inside 0..255 for 8 bit input, so no
+ * clamping is needed. Output is within 1 of rgb_to_yuv420_float().
+ */
+void rgb_to_yuv420_fixed(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
+{
+    int width = ctx->width;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *p = rgb + (size_t)i * width * 3;
+        unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+
+        for (int j = 0; j < width; j++, p += 3)
+            y_row[j] = YUV_FIX_Y(p[0], p[1], p[2]);
+
+        /* 4:2:0, chroma is sampled from the top left pixel of each 2x2 block */
+        if (i % 2)
+            continue;
+
+        p = rgb + (size_t)i * width * 3;
+        unsigned char *u_row = yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+
+        for (int j = 0; j < ctx->chroma_width; j++, p += 6)
+        {
+            u_row[j] = YUV_FIX_U(p[0], p[1], p[2]);
+            v_row[j] = YUV_FIX_V(p[0], p[1], p[2]);
+        }
+    }
+}
@@ -0,0 +1,314 @@
+// convert_to_yuv_simd.c
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* two 16 bit madd coefficients packed into one 32 bit lane */
+#define COEF_PAIR(a, b) ((int)(((unsigned int)(unsigned short)(b) << 16) | (unsigned short)(a)))
+
+/* pshufb masks gathering R, G and B out of 16 packed RGB24 pixels */
+#define SHUF_R_A  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_R_B -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1
+#define SHUF_R_C -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13
+#define SHUF_G_A  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_G_B -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1
+#define SHUF_G_C -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14
+#define SHUF_B_A  2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_B_B -1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1
+#define SHUF_B_C -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15
+
+/**
+ * yuv_row_tail - Scalar conversion for the end of a row
+ * @p: RGB24 row
+ * @y_row: Y output row
+ * @u_row: U output row, or NULL on rows without chroma
+ * @v_row: V output row
+ * @from: First pixel to convert
+ * @width: Row width in pixels
+ */
+static void yuv_row_tail(const unsigned char *p, unsigned char *y_row, unsigned char *u_row, unsigned char *v_row, int from, int width)
+{
+    for (int j = from; j < width; j++)
+        y_row[j] = YUV_FIX_Y(p[3*j], p[3*j + 1], p[3*j + 2]);
+
+    if (!u_row)
+        return;
+
+    for (int j = (from + 1) / 2; j < (width + 1) / 2; j++)
+    {
+        u_row[j] = YUV_FIX_U(p[6*j], p[6*j + 1], p[6*j + 2]);
+        v_row[j] = YUV_FIX_V(p[6*j], p[6*j + 1], p[6*j + 2]);
+    }
+}
+
+/**
+ * fix_madd_sse41 - One fixed point conversion on 8 pixels
+ * @r: Red, 8 x 16 bit
+ * @g: Green, 8 x 16 bit
+ * @b: Blue, 8 x 16 bit
+ * @rg: Packed R and G coefficients
+ * @bk: Packed B coefficient
+ * @offset: Rounding offset, 4 x 32 bit
+ *
+ * Return: 8 x 16 bit results
+ */
+__attribute__((target("sse4.1")))
+static inline __m128i fix_madd_sse41(__m128i r, __m128i g, __m128i b, __m128i rg, __m128i bk, __m128i offset)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), rg),
+                               _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), bk));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), rg),
+                               _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), bk));
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, offset), YUV_FIX_SHIFT);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, offset), YUV_FIX_SHIFT);
+
+    return _mm_packs_epi32(lo, hi);
+}
+
+/**
+ * yuv_block_sse41 - Convert 16 pixels of one row
+ * @p: 48 bytes of RGB24
+ * @y: 16 Y outputs
+ * @u: 8 U outputs, or NULL on rows without chroma
+ * @v: 8 V outputs
+ */
+__attribute__((target("sse4.1")))
+static inline void yuv_block_sse41(const unsigned char *p, unsigned char *y, unsigned char *u, unsigned char *v)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i zero = _mm_setzero_si128();
+    __m128i R, G, B, ylo, yhi;
+
+    R = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(SHUF_R_A)),
+                                  _mm_shuffle_epi8(b, _mm_setr_epi8(SHUF_R_B))),
+                     _mm_shuffle_epi8(c, _mm_setr_epi8(SHUF_R_C)));
+    G = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(SHUF_G_A)),
+                                  _mm_shuffle_epi8(b, _mm_setr_epi8(SHUF_G_B))),
+                     _mm_shuffle_epi8(c, _mm_setr_epi8(SHUF_G_C)));
+    B = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(SHUF_B_A)),
+                                  _mm_shuffle_epi8(b, _mm_setr_epi8(SHUF_B_B))),
+                     _mm_shuffle_epi8(c, _mm_setr_epi8(SHUF_B_C)));
+
+    ylo = fix_madd_sse41(_mm_unpacklo_epi8(R, zero), _mm_unpacklo_epi8(G, zero), _mm_unpacklo_epi8(B, zero),
+                         _mm_set1_epi32(COEF_PAIR(YUV_FIX_Y_R, YUV_FIX_Y_G)),
+                         _mm_set1_epi32(COEF_PAIR(YUV_FIX_Y_B, 0)), _mm_set1_epi32(YUV_FIX_HALF));
+    yhi = fix_madd_sse41(_mm_unpackhi_epi8(R, zero), _mm_unpackhi_epi8(G, zero), _mm_unpackhi_epi8(B, zero),
+                         _mm_set1_epi32(COEF_PAIR(YUV_FIX_Y_R, YUV_FIX_Y_G)),
+                         _mm_set1_epi32(COEF_PAIR(YUV_FIX_Y_B, 0)), _mm_set1_epi32(YUV_FIX_HALF));
+    _mm_storeu_si128((__m128i *)y, _mm_packus_epi16(ylo, yhi));
+
+    if (!u)
+        return;
+
+    /* the low byte of each 16 bit lane is an even pixel */
+    __m128i even = _mm_set1_epi16(0x00ff);
+    __m128i Re = _mm_and_si128(R, even), Ge = _mm_and_si128(G, even), Be = _mm_and_si128(B, even);
+    __m128i uu = fix_madd_sse41(Re, Ge, Be, _mm_set1_epi32(COEF_PAIR(YUV_FIX_U_R, YUV_FIX_U_G)),
+                                _mm_set1_epi32(COEF_PAIR(YUV_FIX_U_B, 0)), _mm_set1_epi32(YUV_FIX_UV_OFFSET));
+    __m128i vv = fix_madd_sse41(Re, Ge, Be, _mm_set1_epi32(COEF_PAIR(YUV_FIX_V_R, YUV_FIX_V_G)),
+                                _mm_set1_epi32(COEF_PAIR(YUV_FIX_V_B, 0)), _mm_set1_epi32(YUV_FIX_UV_OFFSET));
+
+    _mm_storel_epi64((__m128i *)u, _mm_packus_epi16(uu, uu));
+    _mm_storel_epi64((__m128i *)v, _mm_packus_epi16(vv, vv));
+}
+
+/**
+ * rgb_to_yuv420_sse41 - SSE4.1 fixed point RGB24 to YUV420 conversion
+ * @ctx: Encoder context
+ * @rgb: RGB24 pixels, ctx->frame_size bytes
+ * @yuv: Output frame
+ * @row_start: First row to convert, even
+ * @row_end: Row after the last one to convert
+ *
+ * Converts 16 pixels at a time, bit identical to rgb_to_yuv420_fixed()
+ */
+__attribute__((target("sse4.1")))
+void rgb_to_yuv420_sse41(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
+{
+    int width = ctx->width;
+    int blocks = width / 16;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *p = rgb + (size_t)i * width * 3;
+        unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        unsigned char *u_row = i % 2 ? NULL : yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+
+        for (int k = 0; k < blocks; k++)
+            yuv_block_sse41(p + 48*k, y_row + 16*k, u_row ? u_row + 8*k : NULL, v_row + 8*k);
+
+        yuv_row_tail(p, y_row, u_row, v_row, blocks * 16, width);
+    }
+}
+
+/**
+ * fix_madd_avx2 - One fixed point conversion on 16 pixels
+ * @r: Red, 16 x 16 bit
+ * @g: Green, 16 x 16 bit
+ * @b: Blue, 16 x 16 bit
+ * @rg: Packed R and G coefficients
+ * @bk: Packed B coefficient
+ * @offset: Rounding offset, 8 x 32 bit
+ *
+ * Return: 16 x 16 bit results, in the same lane order as the inputs
+ */
+__attribute__((target("avx2")))
+static inline __m256i fix_madd_avx2(__m256i r, __m256i g, __m256i b, __m256i rg, __m256i bk, __m256i offset)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), rg),
+                                  _mm256_madd_epi16(_mm256_unpacklo_epi16(b, zero), bk));
+    __m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), rg),
+                                  _mm256_madd_epi16(_mm256_unpackhi_epi16(b, zero), bk));
+
+    lo = _mm256_srai_epi32(_mm256_add_epi32(lo, offset), YUV_FIX_SHIFT);
+    hi = _mm256_srai_epi32(_mm256_add_epi32(hi, offset), YUV_FIX_SHIFT);
+
+    return _mm256_packs_epi32(lo, hi);
+}
+
+/**
+ * yuv_block_avx2 - Convert 32 pixels of one row
+ * @p: 96 bytes of RGB24
+ * @y: 32 Y outputs
+ * @u: 16 U outputs, or NULL on rows without chroma
+ * @v: 16 V outputs
+ *
+ * Pixels 0-15 go in the low lane and 16-31 in the high lane, so the in
+ * lane shuffles, unpacks and packs keep them in order.
+ */
+__attribute__((target("avx2")))
+static inline void yuv_block_avx2(const unsigned char *p, unsigned char *y, unsigned char *u, unsigned char *v)
+{
+    __m256i a = _mm256_loadu2_m128i((const __m128i *)(p + 48), (const __m128i *)p);
+    __m256i b = _mm256_loadu2_m128i((const __m128i *)(p + 64), (const __m128i *)(p + 16));
+    __m256i c = _mm256_loadu2_m128i((const __m128i *)(p + 80), (const __m128i *)(p + 32));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i R, G, B, ylo, yhi;
+
+    R = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, _mm256_setr_epi8(SHUF_R_A, SHUF_R_A)),
+                                        _mm256_shuffle_epi8(b, _mm256_setr_epi8(SHUF_R_B, SHUF_R_B))),
+                        _mm256_shuffle_epi8(c, _mm256_setr_epi8(SHUF_R_C, SHUF_R_C)));
+    G = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, _mm256_setr_epi8(SHUF_G_A, SHUF_G_A)),
+                                        _mm256_shuffle_epi8(b, _mm256_setr_epi8(SHUF_G_B, SHUF_G_B))),
+                        _mm256_shuffle_epi8(c, _mm256_setr_epi8(SHUF_G_C, SHUF_G_C)));
+    B = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, _mm256_setr_epi8(SHUF_B_A, SHUF_B_A)),
+                                        _mm256_shuffle_epi8(b, _mm256_setr_epi8(SHUF_B_B, SHUF_B_B))),
+                        _mm256_shuffle_epi8(c, _mm256_setr_epi8(SHUF_B_C, SHUF_B_C)));
+
+    ylo = fix_madd_avx2(_mm256_unpacklo_epi8(R, zero), _mm256_unpacklo_epi8(G, zero), _mm256_unpacklo_epi8(B, zero),
+                        _mm256_set1_epi32(COEF_PAIR(YUV_FIX_Y_R, YUV_FIX_Y_G)),
+                        _mm256_set1_epi32(COEF_PAIR(YUV_FIX_Y_B, 0)), _mm256_set1_epi32(YUV_FIX_HALF));
+    yhi = fix_madd_avx2(_mm256_unpackhi_epi8(R, zero), _mm256_unpackhi_epi8(G, zero), _mm256_unpackhi_epi8(B, zero),
+                        _mm256_set1_epi32(COEF_PAIR(YUV_FIX_Y_R, YUV_FIX_Y_G)),
+                        _mm256_set1_epi32(COEF_PAIR(YUV_FIX_Y_B, 0)), _mm256_set1_epi32(YUV_FIX_HALF));
+    _mm256_storeu_si256((__m256i *)y, _mm256_packus_epi16(ylo, yhi));
+
+    if (!u)
+        return;
+
+    /* the low byte of each 16 bit lane is an even pixel */
+    __m256i even = _mm256_set1_epi16(0x00ff);
+    __m256i Re = _mm256_and_si256(R, even), Ge = _mm256_and_si256(G, even), Be = _mm256_and_si256(B, even);
+    __m256i uu = fix_madd_avx2(Re, Ge, Be, _mm256_set1_epi32(COEF_PAIR(YUV_FIX_U_R, YUV_FIX_U_G)),
+                               _mm256_set1_epi32(COEF_PAIR(YUV_FIX_U_B, 0)), _mm256_set1_epi32(YUV_FIX_UV_OFFSET));
+    __m256i vv = fix_madd_avx2(Re, Ge, Be, _mm256_set1_epi32(COEF_PAIR(YUV_FIX_V_R, YUV_FIX_V_G)),
+                               _mm256_set1_epi32(COEF_PAIR(YUV_FIX_V_B, 0)), _mm256_set1_epi32(YUV_FIX_UV_OFFSET));
+
+    /* packing leaves 8 results in each lane, gather them into the low half */
+    uu = _mm256_permute4x64_epi64(_mm256_packus_epi16(uu, uu), 0xd8);
+    vv = _mm256_permute4x64_epi64(_mm256_packus_epi16(vv, vv), 0xd8);
+    _mm_storeu_si128((__m128i *)u, _mm256_castsi256_si128(uu));
+    _mm_storeu_si128((__m128i *)v, _mm256_castsi256_si128(vv));
+}
+
+/**
+ * rgb_to_yuv420_avx2 - AVX2 fixed point RGB24 to YUV420 conversion
+ * @ctx: Encoder context
+ * @rgb: RGB24 pixels, ctx->frame_size bytes
+ * @yuv: Output frame
+ * @row_start: First row to convert, even
+ * @row_end: Row after the last one to convert
+ *
+ * Converts 32 pixels at a time, then 16, bit identical to
+ * rgb_to_yuv420_fixed()
+ */
+__attribute__((target("avx2")))
+void rgb_to_yuv420_avx2(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
+{
+    int width = ctx->width;
+    int blocks = width / 32;
+    int done = blocks * 32;
+
+    for (int i = row_start; i < row_end; i++)
+    {
+        const unsigned char *p = rgb + (size_t)i * width * 3;
+        unsigned char *y_row = yuv->plane[0] + (size_t)i * yuv->stride[0];
+        unsigned char *u_row = i % 2 ? NULL : yuv->plane[1] + (size_t)(i/2) * yuv->stride[1];
+        unsigned char *v_row = yuv->plane[2] + (size_t)(i/2) * yuv->stride[2];
+        int j = done;
+
+        for (int k = 0; k < blocks; k++)
+            yuv_block_avx2(p + 96*k, y_row + 32*k, u_row ? u_row + 16*k : NULL, v_row + 16*k);
+
+        if (width - j >= 16)
+        {
+            yuv_block_sse41(p + 3*j, y_row + j, u_row ? u_row + j/2 : NULL, v_row + j/2);
+            j += 16;
+        }
+
+        yuv_row_tail(p, y_row, u_row, v_row, j, width);
+    }
+}
+
+/**
+ * cpu_has_sse41 - Check for SSE4.1 support
+ *
+ * Return: Non zero if the CPU supports SSE4.1
+ */
+int cpu_has_sse41(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+}
+
+/**
+ * cpu_has_avx2 - Check for AVX2 support
+ *
+ * Return: Non zero if the CPU supports AVX2
+ */
+int cpu_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else /* no x86 vector kernels */
+
+void rgb_to_yuv420_sse41(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
+{
+    rgb_to_yuv420_fixed(ctx, rgb, yuv, row_start, row_end);
+}
+
+void rgb_to_yuv420_avx2(encoder_context *ctx, const unsigned char *rgb, const yuv_frame *yuv, int row_start, int row_end)
+{
+    rgb_to_yuv420_fixed(ctx, rgb, yuv, row_start, row_end);
+}
+
+int cpu_has_sse41(void)
+{
+    return 0;
+}
+
+int cpu_has_avx2(void)
+{
+    return 0;
+}
+
+#endif
@@ -12,11 +12,7 @@ void create_delta_frames(video_frame *frames, int frame_count)
 {
     for (int i = frame_count - 1; i > 0; i--) {
         printf("\ndelta in %d frame\n", i);
-        for (int j = 0; j < frames[i].size; j++) {
-            // printf("delta in %d frame  ", j);
-            frames[i].data[j] -= frames[i-1].data[j];
-        }
-        // printf("\n");
+        subtract_frame(frames[i].data, frames[i].data, frames[i-1].data, frames[i].size);
     }
 }
 
@@ -1,41 +1,237 @@
 // decode_frames.c
 #include "codec.h"
+#include <limits.h>
 
 /**
- * decode_frames - Decode the compressed frames
+ * decode_chunk - Inflate and reconstruct the frames of one chunk
  * @ctx: Encoder context
- * @compressed_data: Compressed frame data
- * @compressed_size: size of compressed data
- * @frames: Array to store decoded frames
- * @frame_count: Number of frames
+ * @data: Compressed chunk
+ * @size: Compressed size of the chunk
+ * @skip: Frames at the start of the chunk to reconstruct but not keep
+ * @frames: Frames of the chunk to keep, with their buffers already
+ * taken from the arena
+ * @count: Number of frames to keep
+ * @scratch: Two buffers for the skipped frames, unused if @skip is 0
+ *
+ * Return: 0 on success, -1 on failure
  */
-void decode_frames(encoder_context *ctx, unsigned char *compressed_data, size_t compressed_size, video_frame *frames, int frame_count)
+static int decode_chunk(encoder_context *ctx, unsigned char *data, size_t size, int skip, video_frame *frames,
+                        int count, unsigned char *scratch[2])
 {
+    unsigned char *prev = NULL;
     z_stream strm;
+    int ret = 0;
 
     /* init zlib */
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
-    strm.avail_in = compressed_size;
-    strm.next_in = compressed_data;
-    inflateInit(&strm);
+    strm.avail_in = size;
+    strm.next_in = data;
+    if (inflateInit(&strm) != Z_OK)
+        return -1;
 
-    /* Decompress frames */
-    for (int i = 0; i < frame_count; i++) {
-        frames[i].data = malloc(ctx->yuv_size);
-        frames[i].size = ctx->yuv_size;
+    /* Decompress frames, reconstructing each one while it is still in cache */
+    for (int i = 0; i < skip + count; i++) {
+        unsigned char *frame = i < skip ? scratch[i % 2] : frames[i - skip].data;
 
         strm.avail_out = ctx->yuv_size;
-        strm.next_out = frames[i].data;
+        strm.next_out = frame;
         inflate(&strm, Z_NO_FLUSH);
+        if (strm.avail_out != 0)
+            ret = -1;
+
+        if (i > 0)
+            add_frame(frame, frame, prev, ctx->yuv_size);
+        prev = frame;
     }
 
     inflateEnd(&strm);
 
-    /* reconstruct frames from deltas */
-    for (int i = 1; i < frame_count; i++) {
-        for (int j = 0; j < frames[i].size; j++)
-            frames[i].data[j] += frames[i-1].data[j];
+    return ret;
+}
+
+/* one chunk of a decode_frames() call */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    int skip;
+    int first;
+    int count;
+    int status;
+} chunk_job;
+
+/* shared by every task of a decode_frames() call */
+typedef struct {
+    encoder_context *ctx;
+    chunk_job *jobs;
+    video_frame *frames;
+    unsigned char *scratch[2];
+} decode_job;
+
+/**
+ * decode_task - Decode one chunk, run on the worker pool
+ * @arg: Decode job
+ * @index: Chunk to decode
+ */
+static void decode_task(void *arg, int index)
+{
+    decode_job *job = arg;
+    chunk_job *chunk = &job->jobs[index];
+
+    chunk->status = decode_chunk(job->ctx, chunk->data, chunk->size, chunk->skip, job->frames + chunk->first,
+                                 chunk->count, job->scratch);
+    if (chunk->status != 0)
+        fprintf(stderr, "Error decoding chunk at frame %d\n", chunk->first);
+}
+
+/**
+ * find_chunks - Locate the chunks of a stream
+ * @data: Whole stream
+ * @size: Size of the stream
+ * @hdr: Parsed stream header
+ * @jobs: Array of @frame_count entries to fill in
+ * @first_frame: First frame wanted
+ * @frame_count: Number of frames wanted
+ *
+ * The index at the end of the stream gives every chunk straight away. A
+ * stream without one, e.g. cut short, is walked chunk by chunk from the
+ * header instead, for as far as it is intact. Chunks ending before
+ * @first_frame are passed over without being inflated.
+ *
+ * Return: Number of chunks found
+ */
+static int find_chunks(unsigned char *data, size_t size, const stream_header *hdr, chunk_job *jobs, int first_frame,
+                       int frame_count)
+{
+    stream_footer ftr;
+    chunk_entry *index = NULL;
+    size_t pos = hdr->header_size;
+    int chunks = 0;
+    int start = 0;
+    int first = 0;
+    int next = 0;
+
+    if (size >= (size_t)hdr->header_size + STREAM_FOOTER_SIZE &&
+        parse_stream_footer(data + size - STREAM_FOOTER_SIZE, size, &ftr) == 0) {
+        index = malloc((ftr.chunk_count > 0 ? ftr.chunk_count : 1) * sizeof(*index));
+        if (index && parse_stream_index(data + ftr.index_offset, &ftr, index) != 0) {
+            free(index);
+            index = NULL;
+        }
+    }
+
+    while (first < frame_count) {
+        chunk_header chdr;
+        chunk_job *chunk = &jobs[chunks];
+
+        if (index) {
+            if (next == ftr.chunk_count)
+                break;
+            pos = index[next++].offset;
+        }
+
+        if (pos + CHUNK_HEADER_SIZE > size)
+            break;
+        parse_chunk_header(data + pos, &chdr);
+        pos += CHUNK_HEADER_SIZE;
+        if (chdr.size > size - pos || chdr.frames == 0 || chdr.frames > (unsigned int)(INT_MAX - start))
+            break;
+
+        if (start + (int)chdr.frames > first_frame) {
+            chunk->data = data + pos;
+            chunk->size = chdr.size;
+            chunk->skip = first_frame > start ? first_frame - start : 0;
+            chunk->first = first;
+            chunk->count = (int)chdr.frames - chunk->skip;
+            if (chunk->count > frame_count - first)
+                chunk->count = frame_count - first;
+
+            first += chunk->count;
+            chunks++;
+        }
+
+        pos += chdr.size;
+        start += chdr.frames;
     }
+
+    free(index);
+
+    return chunks;
+}
+
+/**
+ * decode_frames - Decode the compressed frames
+ * @ctx: Encoder context
+ * @compressed_data: Stream written by encode_stream()
+ * @compressed_size: size of compressed data
+ * @first_frame: First frame to decode
+ * @frames: Array to store decoded frames
+ * @frame_count: Number of frames
+ *
+ * Every chunk starts with a key frame and is a zlib stream of its own, so
+ * once the chunks are found they are decoded in parallel on ctx->pool,
+ * each straight into its place in @frames. Frames of the first chunk
+ * ahead of @first_frame are reconstructed but not kept, so a long stream
+ * can be decoded a few chunks per call. Frames missing from a truncated
+ * or damaged stream are left zeroed.
+ *
+ * The frame buffers are taken from ctx->yuv_arena as one contiguous
+ * block before the workers start, since the arena is not locked. Give
+ * them back with arena_free().
+ *
+ * Return: 0 on success, -1 if the stream does not match @ctx or not all
+ * frames could be decoded
+ */
+int decode_frames(encoder_context *ctx, unsigned char *compressed_data, size_t compressed_size, int first_frame,
+                  video_frame *frames, int frame_count)
+{
+    decode_job job = {ctx, NULL, frames, {NULL, NULL}};
+    stream_header hdr;
+    int chunks = 0;
+    int first = 0;
+    int ret = 0;
+
+    if (compressed_size < STREAM_HEADER_SIZE || parse_stream_header(compressed_data, &hdr) != 0)
+        return -1;
+    if (hdr.width != ctx->width || hdr.height != ctx->height) {
+        fprintf(stderr, "Stream is %dx%d, expected %dx%d\n", hdr.width, hdr.height, ctx->width, ctx->height);
+        return -1;
+    }
+
+    if (first_frame < 0 || arena_reserve(&ctx->yuv_arena, frame_count + 2) != 0)
+        return -1;
+    for (int i = 0; i < frame_count; i++) {
+        frames[i].data = arena_alloc(&ctx->yuv_arena);
+        frames[i].size = ctx->yuv_size;
+    }
+
+    /* a chunk holds at least one frame */
+    job.jobs = malloc((frame_count > 0 ? frame_count : 1) * sizeof(*job.jobs));
+    if (job.jobs)
+        chunks = find_chunks(compressed_data, compressed_size, &hdr, job.jobs, first_frame, frame_count);
+
+    /* only the first chunk can start ahead of the range */
+    if (chunks > 0 && job.jobs[0].skip > 0) {
+        job.scratch[0] = arena_alloc(&ctx->yuv_arena);
+        job.scratch[1] = arena_alloc(&ctx->yuv_arena);
+    }
+
+    pool_run(ctx->pool, decode_task, &job, chunks);
+    for (int i = 0; i < chunks; i++) {
+        if (job.jobs[i].status != 0)
+            ret = -1;
+        first += job.jobs[i].count;
+    }
+    free(job.jobs);
+    arena_free(&ctx->yuv_arena, job.scratch[0]);
+    arena_free(&ctx->yuv_arena, job.scratch[1]);
+
+    if (first < frame_count)
+        fprintf(stderr, "Stream holds only %d of %d frames\n", first, frame_count);
+
+    for (int i = first; i < frame_count; i++)
+        memset(frames[i].data, 0, ctx->yuv_size);
+
+    return first == frame_count ? ret : -1;
 }
@@ -0,0 +1,66 @@
+// decode_range.c
+#include "codec.h"
+
+/**
+ * decode_range - Decode a run of frames from an encoded file
+ * @ctx: Encoder context
+ * @fp: Encoded file, must be seekable
+ * @first_frame: First frame to decode
+ * @count: Number of frames to decode
+ * @frames: Array of @count frames to store the decoded frames in
+ *
+ * A stream decoder is moved to @first_frame with stream_decoder_seek(),
+ * so only the chunks from the key frame at or before it are read and
+ * inflated, and decoding stops right after the last frame asked for.
+ * Each frame is copied out as it is decoded, so for long runs it is
+ * cheaper to read them straight from the stream decoder instead.
+ *
+ * The frames come from ctx->yuv_arena, reserved up front as one block.
+ * Give them back with arena_free().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int decode_range(encoder_context *ctx, FILE *fp, int first_frame, int count, video_frame *frames)
+{
+    stream_decoder dec = {0};
+    const unsigned char *yuv;
+    int ret = -1;
+
+    for (int i = 0; i < count; i++)
+        frames[i].data = NULL;
+
+    if (count <= 0 || fseeko(fp, 0, SEEK_SET) != 0 || stream_decoder_init(&dec, ctx, fp) != 0)
+        goto cleanup;
+    if (arena_reserve(&ctx->yuv_arena, count + 1) != 0 || stream_decoder_seek(&dec, first_frame) != 0)
+        goto cleanup;
+
+    for (int i = 0; i < count; i++) {
+        if (!(yuv = decoder_next_frame(&dec))) {
+            if (!dec.error)
+                fprintf(stderr, "Frames %d..%ld out of range, stream has %d\n", first_frame,
+                        (long)first_frame + count - 1, dec.frame_count);
+            goto cleanup;
+        }
+
+        frames[i].data = arena_alloc(&ctx->yuv_arena);
+        frames[i].size = ctx->yuv_size;
+        if (!frames[i].data)
+            goto cleanup;
+        memcpy(frames[i].data, yuv, ctx->yuv_size);
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret != 0) {
+        fprintf(stderr, "Error decoding frames from %d\n", first_frame);
+        for (int i = 0; i < count; i++) {
+            arena_free(&ctx->yuv_arena, frames[i].data);
+            frames[i].data = NULL;
+        }
+    }
+    if (dec.ctx)
+        stream_decoder_free(&dec);
+
+    return ret;
+}
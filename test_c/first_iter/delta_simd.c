@@ -0,0 +1,210 @@
+// delta_simd.c
+#include "codec.h"
+
+/* a delta or reconstruct kernel, out may alias either input */
+typedef void (*delta_kernel)(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size);
+
+/**
+ * subtract_scalar - out = a - b, one byte at a time
+ * @out: Output buffer
+ * @a: First operand
+ * @b: Second operand
+ * @size: Number of bytes
+ */
+static void subtract_scalar(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    for (size_t j = 0; j < size; j++)
+        out[j] = a[j] - b[j];
+}
+
+/**
+ * add_scalar - out = a + b, one byte at a time
+ * @out: Output buffer
+ * @a: First operand
+ * @b: Second operand
+ * @size: Number of bytes
+ */
+static void add_scalar(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    for (size_t j = 0; j < size; j++)
+        out[j] = a[j] + b[j];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* SSE2 is part of x86-64, so no target attribute is needed for it */
+static void subtract_sse2(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+
+    for (; j + 16 <= size; j += 16)
+        _mm_storeu_si128((__m128i *)(out + j), _mm_sub_epi8(_mm_loadu_si128((const __m128i *)(a + j)),
+                                                            _mm_loadu_si128((const __m128i *)(b + j))));
+    subtract_scalar(out + j, a + j, b + j, size - j);
+}
+
+static void add_sse2(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+
+    for (; j + 16 <= size; j += 16)
+        _mm_storeu_si128((__m128i *)(out + j), _mm_add_epi8(_mm_loadu_si128((const __m128i *)(a + j)),
+                                                            _mm_loadu_si128((const __m128i *)(b + j))));
+    add_scalar(out + j, a + j, b + j, size - j);
+}
+
+/* AVX2 leaves at most one SSE2 step and a scalar tail */
+__attribute__((target("avx2")))
+static void subtract_avx2(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+
+    for (; j + 32 <= size; j += 32)
+        _mm256_storeu_si256((__m256i *)(out + j), _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(a + j)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b + j))));
+    subtract_sse2(out + j, a + j, b + j, size - j);
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+
+    for (; j + 32 <= size; j += 32)
+        _mm256_storeu_si256((__m256i *)(out + j), _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(a + j)),
+                                                                  _mm256_loadu_si256((const __m256i *)(b + j))));
+    add_sse2(out + j, a + j, b + j, size - j);
+}
+
+/* AVX-512 finishes the tail with one masked load and store */
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static void subtract_avx512(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+    __mmask64 tail;
+
+    for (; j + 64 <= size; j += 64)
+        _mm512_storeu_si512(out + j, _mm512_sub_epi8(_mm512_loadu_si512(a + j), _mm512_loadu_si512(b + j)));
+
+    if (j < size) {
+        tail = _bzhi_u64(~0ULL, size - j);
+        _mm512_mask_storeu_epi8(out + j, tail, _mm512_sub_epi8(_mm512_maskz_loadu_epi8(tail, a + j),
+                                                               _mm512_maskz_loadu_epi8(tail, b + j)));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static void add_avx512(unsigned char *out, const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t j = 0;
+    __mmask64 tail;
+
+    for (; j + 64 <= size; j += 64)
+        _mm512_storeu_si512(out + j, _mm512_add_epi8(_mm512_loadu_si512(a + j), _mm512_loadu_si512(b + j)));
+
+    if (j < size) {
+        tail = _bzhi_u64(~0ULL, size - j);
+        _mm512_mask_storeu_epi8(out + j, tail, _mm512_add_epi8(_mm512_maskz_loadu_epi8(tail, a + j),
+                                                               _mm512_maskz_loadu_epi8(tail, b + j)));
+    }
+}
+#endif
+
+static delta_kernel subtract_kernel = subtract_scalar;
+static delta_kernel add_kernel = add_scalar;
+static pthread_once_t delta_once = PTHREAD_ONCE_INIT;
+
+/**
+ * pick_delta_kernels - Install the widest kernels up to @max
+ * @max: Widest instruction set to use
+ *
+ * Return: The instruction set picked
+ */
+static simd_level pick_delta_kernels(simd_level max)
+{
+    simd_level level = SIMD_NONE;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (max >= SIMD_AVX512 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2"))
+        level = SIMD_AVX512;
+    else if (max >= SIMD_AVX2 && __builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    else if (max >= SIMD_SSE2)
+        level = SIMD_SSE2;
+
+    switch (level) {
+    case SIMD_AVX512:
+        subtract_kernel = subtract_avx512;
+        add_kernel = add_avx512;
+        break;
+    case SIMD_AVX2:
+        subtract_kernel = subtract_avx2;
+        add_kernel = add_avx2;
+        break;
+    case SIMD_SSE2:
+        subtract_kernel = subtract_sse2;
+        add_kernel = add_sse2;
+        break;
+    default:
+        subtract_kernel = subtract_scalar;
+        add_kernel = add_scalar;
+        break;
+    }
+#else
+    subtract_kernel = subtract_scalar;
+    add_kernel = add_scalar;
+#endif
+
+    return level;
+}
+
+/**
+ * select_best_delta_kernels - Default kernel choice, run once on first use
+ */
+static void select_best_delta_kernels(void)
+{
+    pick_delta_kernels(SIMD_AVX512);
+}
+
+/**
+ * select_delta_kernels - Limit the delta and reconstruct kernels
+ * @max: Widest instruction set to use
+ *
+ * By default the widest kernels the CPU supports are used. This is meant
+ * for benchmarks and must not race with subtract_frame() or add_frame().
+ *
+ * Return: The instruction set picked
+ */
+simd_level select_delta_kernels(simd_level max)
+{
+    pthread_once(&delta_once, select_best_delta_kernels);
+    return pick_delta_kernels(max);
+}
+
+/**
+* subtract_frame - Compute the delta between two frames
+* @delta: Output buffer, may be the same as @cur
+* @cur: Current frame
+* @prev: Previous (reference) frame
+* @size: Number of bytes in each frame
+*/
+void subtract_frame(unsigned char *delta, const unsigned char *cur, const unsigned char *prev, size_t size)
+{
+    pthread_once(&delta_once, select_best_delta_kernels);
+    subtract_kernel(delta, cur, prev, size);
+}
+
+/**
+* add_frame - Reconstruct a frame from its delta
+* @frame: Output buffer, may be the same as @delta
+* @delta: Delta frame
+* @prev: Previous (reference) frame
+* @size: Number of bytes in each frame
+*/
+void add_frame(unsigned char *frame, const unsigned char *delta, const unsigned char *prev, size_t size)
+{
+    pthread_once(&delta_once, select_best_delta_kernels);
+    add_kernel(frame, delta, prev, size);
+}
@@ -0,0 +1,692 @@
+// encode_stream.c
+#include "codec.h"
+
+/**
+ * feed_deflate - Compress bytes into a chunk's deflate stream
+ * @chunk: Chunk being compressed
+ * @data: Bytes to add
+ * @size: Number of bytes
+ * @flush: Z_NO_FLUSH, or Z_FINISH to end the chunk
+ *
+ * The output buffer grows as needed, so the chunk only ever holds its
+ * compressed bytes. zlib's output does not depend on how the input is
+ * split between calls.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int feed_deflate(gop_chunk *chunk, const unsigned char *data, size_t size, int flush)
+{
+    z_stream *strm = &chunk->strm;
+    int ret;
+
+    strm->next_in = (unsigned char *)data;
+    strm->avail_in = size;
+    do {
+        if (chunk->size == chunk->capacity) {
+            size_t capacity = chunk->capacity ? chunk->capacity * 2 : STREAM_CHUNK;
+            unsigned char *grown = realloc(chunk->data, capacity);
+
+            if (!grown)
+                return -1;
+            chunk->data = grown;
+            chunk->capacity = capacity;
+        }
+
+        strm->next_out = chunk->data + chunk->size;
+        strm->avail_out = chunk->capacity - chunk->size;
+        ret = deflate(strm, flush);
+        chunk->size = chunk->capacity - strm->avail_out;
+        if (ret == Z_STREAM_ERROR)
+            return -1;
+    } while (strm->avail_in > 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+    return 0;
+}
+
+/**
+ * store_rows - Delta code rows of one plane and compress them
+ * @chunk: Chunk the frame belongs to
+ * @cur: Current frame
+ * @p: Plane, 0 for Y
+ * @row_start: First row to store
+ * @row_end: Row after the last one to store
+ * @key: Non zero to store the frame itself instead of a delta
+ *
+ * The rows are packed into the chunk's band buffer and handed to deflate
+ * straight away, while still in cache. Works a row at a time so @cur and
+ * the reference may be padded.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int store_rows(gop_chunk *chunk, const yuv_frame *cur, int p, int row_start, int row_end, int key)
+{
+    size_t width = cur->width[p];
+
+    for (int i = row_start; i < row_end; i++) {
+        unsigned char *out = chunk->band + (i - row_start) * width;
+        const unsigned char *in = cur->plane[p] + (size_t)i * cur->stride[p];
+
+        if (key)
+            memcpy(out, in, width);
+        else
+            subtract_frame(out, in, chunk->ref.plane[p] + (size_t)i * chunk->ref.stride[p], width);
+    }
+
+    return feed_deflate(chunk, chunk->band, (row_end - row_start) * width, Z_NO_FLUSH);
+}
+
+/**
+ * store_chroma - Delta code and compress both chroma planes of a frame
+ * @enc: Stream encoder
+ * @chunk: Chunk the frame belongs to
+ * @cur: Current frame
+ * @key: Non zero for a key frame
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int store_chroma(stream_encoder *enc, gop_chunk *chunk, const yuv_frame *cur, int key)
+{
+    for (int p = 1; p < 3; p++) {
+        for (int row = 0; row < cur->height[p]; row += enc->band_rows) {
+            int end = row + enc->band_rows < cur->height[p] ? row + enc->band_rows : cur->height[p];
+
+            if (store_rows(chunk, cur, p, row, end, key) != 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * encode_rgb - Convert, delta code and compress one RGB24 frame
+ * @enc: Stream encoder
+ * @chunk: Chunk the frame belongs to
+ * @rgb: RGB24 frame, ctx->frame_size bytes
+ * @use_pool: Non zero to convert the whole frame on the worker pool first
+ *
+ * Without the pool the frame is converted a band of rows at a time and
+ * each band is delta coded and compressed straight away. Afterwards only
+ * the converted frame is kept, as the next reference.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int encode_rgb(stream_encoder *enc, gop_chunk *chunk, const unsigned char *rgb, int use_pool)
+{
+    encoder_context *ctx = enc->ctx;
+    int key = chunk->frames == 0;
+    yuv_frame tmp;
+
+    if (use_pool)
+        rgb_to_yuv420(ctx, rgb, &chunk->cur);
+
+    for (int row = 0; row < ctx->height; row += enc->band_rows) {
+        int end = row + enc->band_rows < ctx->height ? row + enc->band_rows : ctx->height;
+
+        if (!use_pool)
+            ctx->yuv_kernel(ctx, rgb, &chunk->cur, row, end);
+
+        if (store_rows(chunk, &chunk->cur, 0, row, end, key) != 0)
+            return -1;
+    }
+    if (store_chroma(enc, chunk, &chunk->cur, key) != 0)
+        return -1;
+
+    /* current frame becomes the reference for the next one */
+    tmp = chunk->ref;
+    chunk->ref = chunk->cur;
+    chunk->cur = tmp;
+    chunk->frames++;
+
+    return 0;
+}
+
+/**
+ * encode_yuv - Delta code and compress one YUV420 frame
+ * @enc: Stream encoder
+ * @chunk: Chunk the frame belongs to
+ * @yuv: YUV420 frame of the context's size, in any layout
+ *
+ * The frame is copied as the next reference, since @yuv is only valid
+ * until the source reads its next frame.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int encode_yuv(stream_encoder *enc, gop_chunk *chunk, const yuv_frame *yuv)
+{
+    int key = chunk->frames == 0;
+
+    for (int row = 0; row < yuv->height[0]; row += enc->band_rows) {
+        int end = row + enc->band_rows < yuv->height[0] ? row + enc->band_rows : yuv->height[0];
+
+        if (store_rows(chunk, yuv, 0, row, end, key) != 0)
+            return -1;
+    }
+    if (store_chroma(enc, chunk, yuv, key) != 0)
+        return -1;
+
+    copy_frame_planes(&chunk->ref, yuv);
+    chunk->frames++;
+
+    return 0;
+}
+
+/**
+ * encode_gop - Encode one group of pictures, run on the worker pool
+ * @arg: Stream encoder
+ * @index: Chunk to encode, its frames are in chunk->input
+ *
+ * The frames are RGB24 or packed YUV420 straight from a mapped source,
+ * or packed YUV420 from the queue of pushed frames. Every chunk is a
+ * zlib stream of its own, so the result does not depend on which thread
+ * encodes it or in what order.
+ */
+static void encode_gop(void *arg, int index)
+{
+    stream_encoder *enc = arg;
+    gop_chunk *chunk = &enc->chunks[index];
+    yuv_frame planes;
+
+    chunk->status = -1;
+    for (int i = 0; i < chunk->pending; i++) {
+        if (enc->src && enc->src->format == INPUT_RGB24) {
+            if (encode_rgb(enc, chunk, chunk->input[i], 0) != 0)
+                return;
+        } else {
+            init_packed_frame(enc->ctx, chunk->input[i], &planes);
+            if (encode_yuv(enc, chunk, &planes) != 0)
+                return;
+        }
+        if (enc->src)
+            source_release_frame(enc->src, chunk->input[i]);
+    }
+
+    if (feed_deflate(chunk, NULL, 0, Z_FINISH) == 0)
+        chunk->status = 0;
+}
+
+/**
+ * grow_index - Make room for more chunk index entries
+ * @enc: Stream encoder
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int grow_index(stream_encoder *enc)
+{
+    int size = enc->index_size ? enc->index_size * 2 : 64;
+    chunk_entry *index = realloc(enc->index, size * sizeof(*index));
+
+    if (!index)
+        return -1;
+
+    enc->index = index;
+    enc->index_size = size;
+
+    return 0;
+}
+
+/**
+ * write_chunk - Write a compressed chunk out and start the next one
+ * @enc: Stream encoder
+ * @chunk: Chunk whose deflate stream has been finished
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int write_chunk(stream_encoder *enc, gop_chunk *chunk)
+{
+    chunk_header hdr;
+    chunk_entry *entry;
+
+    if (chunk->size > 0xffffffffu) {
+        fprintf(stderr, "GOP too large for one chunk\n");
+        return -1;
+    }
+
+    if (enc->footer.chunk_count == enc->index_size && grow_index(enc) != 0)
+        return -1;
+
+    hdr.size = chunk->size;
+    hdr.frames = chunk->frames;
+    if (write_chunk_header(enc->out, &hdr) != 0 ||
+        fwrite(chunk->data, 1, chunk->size, enc->out) != chunk->size)
+        return -1;
+
+    entry = &enc->index[enc->footer.chunk_count++];
+    entry->offset = enc->offset;
+    entry->first_frame = enc->footer.frame_count;
+    entry->frames = chunk->frames;
+    enc->offset += CHUNK_HEADER_SIZE + chunk->size;
+    enc->footer.frame_count += chunk->frames;
+
+    chunk->frames = 0;
+    chunk->pending = 0;
+    chunk->size = 0;
+
+    return deflateReset(&chunk->strm) == Z_OK ? 0 : -1;
+}
+
+/**
+ * open_chunk - Allocate the frames and deflate stream of a chunk
+ * @enc: Stream encoder
+ * @chunk: Zeroed chunk
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int open_chunk(stream_encoder *enc, gop_chunk *chunk)
+{
+    encoder_context *ctx = enc->ctx;
+
+    init_padded_frame(ctx, arena_alloc(&ctx->yuv_arena), 0, &chunk->ref);
+    init_padded_frame(ctx, arena_alloc(&ctx->yuv_arena), 0, &chunk->cur);
+    chunk->band = malloc((size_t)enc->band_rows * ctx->width);
+    if (!chunk->ref.data || !chunk->cur.data || !chunk->band)
+        return -1;
+
+    chunk->strm.zalloc = Z_NULL;
+    chunk->strm.zfree = Z_NULL;
+    chunk->strm.opaque = Z_NULL;
+    if (deflateInit(&chunk->strm, Z_BEST_COMPRESSION) != Z_OK)
+        return -1;
+    chunk->strm_open = 1;
+
+    return 0;
+}
+
+/**
+ * run_batch - Encode a batch of groups of pictures on the worker pool
+ * @enc: Stream encoder
+ * @frames: Frames of the batch, a group of pictures after another
+ * @count: Number of frames, at most a group per chunk
+ *
+ * Each group goes to a chunk of its own and the chunks are written out
+ * in order once all are done, so the output is the same as encoding one
+ * chunk at a time.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int run_batch(stream_encoder *enc, const unsigned char **frames, int count)
+{
+    int gop_size = enc->ctx->gop_size;
+    int chunks = (count + gop_size - 1) / gop_size;
+
+    for (; enc->open_chunks < chunks; enc->open_chunks++) {
+        if (open_chunk(enc, &enc->chunks[enc->open_chunks]) != 0)
+            return -1;
+    }
+
+    for (int i = 0; i < chunks; i++) {
+        enc->chunks[i].input = frames + i * gop_size;
+        enc->chunks[i].pending = count - i * gop_size < gop_size ? count - i * gop_size : gop_size;
+    }
+
+    pool_run(enc->ctx->pool, encode_gop, enc, chunks);
+
+    for (int i = 0; i < chunks; i++) {
+        if (enc->chunks[i].status != 0) {
+            fprintf(stderr, "failed deflate on chunk of %d frames\n", enc->chunks[i].pending);
+            return -1;
+        }
+        if (write_chunk(enc, &enc->chunks[i]) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * stream_encoder_init - Set up a streaming encoder
+ * @enc: Stream encoder to init
+ * @ctx: Encoder context
+ * @out: Output stream for the compressed data
+ *
+ * Residuals are compressed as they are made, so a chunk in flight holds
+ * two frames, one band of rows and its compressed bytes, whatever the GOP
+ * size or the length of the input.
+ *
+ * With a worker pool up to ctx->threads chunks are in flight. A mapped
+ * file read by encode_stream() is encoded in place. Pushed frames are
+ * converted to YUV420 and held until there is a group of pictures for
+ * every chunk, up to PUSH_BATCH_BYTES of them, then the groups are
+ * deflated in parallel. That costs a batch of frames of memory, so
+ * without a pool, or when not even two groups fit, pushed frames stream
+ * through the first chunk instead.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int stream_encoder_init(stream_encoder *enc, encoder_context *ctx, FILE *out)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->ctx = ctx;
+    enc->out = out;
+
+    if (ctx->gop_size < 1) {
+        fprintf(stderr, "GOP size must be at least 1\n");
+        return -1;
+    }
+
+    /* rows per fused band, even so chroma rows are complete */
+    enc->band_rows = FUSE_BYTES / (ctx->width > 0 ? ctx->width : 1);
+    enc->band_rows -= enc->band_rows % 2;
+    if (enc->band_rows < 2)
+        enc->band_rows = 2;
+
+    enc->chunk_count = ctx->threads > 1 ? ctx->threads : 1;
+    enc->chunks = calloc(enc->chunk_count, sizeof(*enc->chunks));
+    grow_index(enc);
+    if (!enc->chunks || !enc->index || open_chunk(enc, &enc->chunks[0]) != 0) {
+        stream_encoder_free(enc);
+        return -1;
+    }
+    enc->open_chunks = 1;
+
+    if (ctx->pool) {
+        size_t groups = PUSH_BATCH_BYTES / ((size_t)ctx->gop_size * ctx->yuv_size);
+
+        if (groups > (size_t)enc->chunk_count)
+            groups = enc->chunk_count;
+        if (groups > 1)
+            enc->batch_frames = groups * ctx->gop_size;
+    }
+    if (enc->batch_frames > 0 && !(enc->queue = calloc(enc->batch_frames, sizeof(*enc->queue)))) {
+        stream_encoder_free(enc);
+        return -1;
+    }
+
+    if (write_stream_header(out, ctx) != 0) {
+        stream_encoder_free(enc);
+        return -1;
+    }
+    enc->offset = STREAM_HEADER_SIZE;
+
+    return 0;
+}
+
+/**
+ * end_frame - Count a frame pushed into the first chunk, writing it out when full
+ * @enc: Stream encoder
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int end_frame(stream_encoder *enc)
+{
+    gop_chunk *chunk = &enc->chunks[0];
+
+    enc->frame_count++;
+    if (chunk->frames < enc->ctx->gop_size)
+        return 0;
+
+    if (feed_deflate(chunk, NULL, 0, Z_FINISH) != 0) {
+        fprintf(stderr, "failed deflate on chunk of %d frames\n", chunk->frames);
+        return -1;
+    }
+
+    return write_chunk(enc, chunk);
+}
+
+/**
+ * queue_frame - Get the queue buffer for the next pushed frame
+ * @enc: Stream encoder holding pushed frames
+ * @planes: Pointer to store the planes of the buffer
+ *
+ * Buffers are taken from ctx->yuv_arena the first time round and used
+ * again for every batch after.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int queue_frame(stream_encoder *enc, yuv_frame *planes)
+{
+    unsigned char **slot = &enc->queue[enc->queued];
+
+    if (!*slot && !(*slot = arena_alloc(&enc->ctx->yuv_arena)))
+        return -1;
+    init_packed_frame(enc->ctx, *slot, planes);
+
+    return 0;
+}
+
+/**
+ * flush_queue - Encode the pushed frames held so far
+ * @enc: Stream encoder
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int flush_queue(stream_encoder *enc)
+{
+    int count = enc->queued;
+
+    enc->queued = 0;
+
+    return count > 0 ? run_batch(enc, (const unsigned char **)enc->queue, count) : 0;
+}
+
+/**
+ * end_queued - Count a frame added to the queue, encoding the batch when full
+ * @enc: Stream encoder
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int end_queued(stream_encoder *enc)
+{
+    enc->frame_count++;
+    if (++enc->queued < enc->batch_frames)
+        return 0;
+
+    return flush_queue(enc);
+}
+
+/**
+ * stream_encode_frame - Convert, delta code and compress one frame
+ * @enc: Stream encoder
+ * @rgb: RGB24 frame, ctx->frame_size bytes
+ *
+ * Done in one pass (see encode_rgb()), with the conversion on the
+ * worker pool when there is one. The first frame of every chunk is a key
+ * frame, stored as it is, and a chunk is written out as soon as it holds
+ * a full group of pictures. When groups are encoded in parallel (see
+ * stream_encoder_init()) the frame is only converted here, on the pool,
+ * and compressed with the rest of its batch.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int stream_encode_frame(stream_encoder *enc, const unsigned char *rgb)
+{
+    yuv_frame planes;
+
+    if (enc->batch_frames > 0) {
+        if (queue_frame(enc, &planes) != 0)
+            return -1;
+        rgb_to_yuv420(enc->ctx, rgb, &planes);
+        return end_queued(enc);
+    }
+
+    if (encode_rgb(enc, &enc->chunks[0], rgb, enc->ctx->pool != NULL) != 0)
+        return -1;
+
+    return end_frame(enc);
+}
+
+/**
+ * stream_encode_yuv_frame - Delta code and compress one YUV420 frame
+ * @enc: Stream encoder
+ * @yuv: YUV420 frame of the context's size, in any layout
+ *
+ * Like stream_encode_frame() for input that is already YUV420, so there
+ * is no colour conversion.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int stream_encode_yuv_frame(stream_encoder *enc, const yuv_frame *yuv)
+{
+    yuv_frame planes;
+
+    if (enc->batch_frames > 0) {
+        if (queue_frame(enc, &planes) != 0)
+            return -1;
+        copy_frame_planes(&planes, yuv);
+        return end_queued(enc);
+    }
+
+    if (encode_yuv(enc, &enc->chunks[0], yuv) != 0)
+        return -1;
+
+    return end_frame(enc);
+}
+
+/**
+ * stream_encoder_finish - Write the last, usually short, chunk and the index
+ * @enc: Stream encoder
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int stream_encoder_finish(stream_encoder *enc)
+{
+    gop_chunk *chunk = &enc->chunks[0];
+
+    if (flush_queue(enc) != 0)
+        return -1;
+    if (chunk->frames > 0) {
+        if (feed_deflate(chunk, NULL, 0, Z_FINISH) != 0 || write_chunk(enc, chunk) != 0)
+            return -1;
+    }
+
+    enc->footer.index_offset = enc->offset;
+
+    return write_stream_index(enc->out, enc->index, &enc->footer);
+}
+
+/**
+ * stream_encoder_free - Release a streaming encoder
+ * @enc: Stream encoder
+ */
+void stream_encoder_free(stream_encoder *enc)
+{
+    if (enc->chunks) {
+        for (int i = 0; i < enc->chunk_count; i++) {
+            gop_chunk *chunk = &enc->chunks[i];
+
+            if (chunk->strm_open)
+                deflateEnd(&chunk->strm);
+            arena_free(&enc->ctx->yuv_arena, chunk->ref.data);
+            arena_free(&enc->ctx->yuv_arena, chunk->cur.data);
+            free(chunk->band);
+            free(chunk->data);
+        }
+    }
+    if (enc->queue) {
+        for (int i = 0; i < enc->batch_frames; i++)
+            arena_free(&enc->ctx->yuv_arena, enc->queue[i]);
+    }
+    free(enc->chunks);
+    free(enc->index);
+    free(enc->input);
+    free(enc->queue);
+    enc->chunks = NULL;
+    enc->index = NULL;
+    enc->input = NULL;
+    enc->queue = NULL;
+}
+
+/**
+ * encode_mapped - Encode a mapped source a group of pictures per thread
+ * @enc: Stream encoder, nothing encoded yet
+ * @src: Mapped source
+ *
+ * Frames are taken straight from the mapping, so up to one group per
+ * thread is encoded in parallel with nothing copied, and each chunk is
+ * written out in order once its batch is done. Each frame is dropped
+ * from the mapping once encoded, so little of the batch stays resident.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int encode_mapped(stream_encoder *enc, frame_source *src)
+{
+    int gop_size = enc->ctx->gop_size;
+    const unsigned char *frame = NULL;
+
+    enc->src = src;
+    enc->input = malloc((size_t)enc->chunk_count * gop_size * sizeof(*enc->input));
+    if (!enc->input)
+        return -1;
+
+    do {
+        int count = 0;
+
+        /* frames of the batch stay mapped until it is encoded */
+        src->hold = 0;
+        while (count < enc->chunk_count * gop_size && (frame = source_next_frame(src))) {
+            enc->input[count++] = frame;
+            src->hold = 1;
+        }
+        if (count == 0)
+            break;
+
+        if (run_batch(enc, enc->input, count) != 0)
+            return -1;
+        enc->frame_count += count;
+    } while (frame);
+    src->hold = 0;
+
+    return 0;
+}
+
+/**
+ * encode_stream - Encode frames straight from input to output
+ * @ctx: Encoder context
+ * @src: Source of raw frames
+ * @out: Output stream for the compressed data
+ * @frame_count: Pointer to store number of frames encoded
+ *
+ * Each frame is converted, turned into a delta and compressed in one
+ * pass (see stream_encode_frame()), or delta coded as it is for YUV420
+ * input, and every group of pictures is an independent chunk. With a
+ * worker pool the groups are encoded a group per thread in parallel,
+ * straight from the mapping for a mapped input, otherwise from frames
+ * held as they are read (see stream_encoder_init()). The output is a
+ * complete container (see container.c) that decode_frames() reads back,
+ * written front to back so @out may be a pipe. It is the same for any
+ * number of threads.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int encode_stream(encoder_context *ctx, frame_source *src, FILE *out, int *frame_count)
+{
+    stream_encoder enc;
+    const unsigned char *frame;
+    yuv_frame planes;
+    int ret = -1;
+
+    if (stream_encoder_init(&enc, ctx, out) != 0)
+        return -1;
+
+    if (src->map && ctx->pool) {
+        if (encode_mapped(&enc, src) != 0)
+            goto cleanup;
+    }
+
+    while ((frame = source_next_frame(src))) {
+        if (src->format == INPUT_RGB24) {
+            if (stream_encode_frame(&enc, frame) != 0)
+                goto cleanup;
+        } else {
+            init_packed_frame(ctx, frame, &planes);
+            if (stream_encode_yuv_frame(&enc, &planes) != 0)
+                goto cleanup;
+        }
+    }
+
+    if (src->error || (src->fp && ferror(src->fp))) {
+        fprintf(stderr, "Error reading input stream\n");
+        goto cleanup;
+    }
+
+    if (stream_encoder_finish(&enc) != 0)
+        goto cleanup;
+
+    *frame_count = enc.footer.frame_count;
+    ret = 0;
+
+cleanup:
+    stream_encoder_free(&enc);
+
+    return ret;
+}
@@ -0,0 +1,129 @@
+// frame_arena.c
+#include "codec.h"
+
+/**
+ * add_block - Carve a new block of buffers for the arena
+ * @arena: Frame arena
+ * @count: Number of buffers in the block
+ *
+ * The block is one aligned allocation, with a header of FRAME_ALIGN bytes
+ * in front linking it to the other blocks. Its buffers go on the free
+ * list so they are handed out in address order.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int add_block(frame_arena *arena, int count)
+{
+    unsigned char *block = aligned_alloc(FRAME_ALIGN, FRAME_ALIGN + (size_t)count * arena->slot_size);
+
+    if (!block)
+        return -1;
+
+    *(void **)block = arena->blocks;
+    arena->blocks = block;
+
+    for (int i = count - 1; i >= 0; i--)
+        arena_free(arena, block + FRAME_ALIGN + (size_t)i * arena->slot_size);
+    arena->slots += count;
+
+    return 0;
+}
+
+/**
+ * arena_init - Set up an empty frame arena
+ * @arena: Frame arena to init
+ * @size: Largest buffer that will be asked for
+ *
+ * Every buffer is @size rounded up to FRAME_ALIGN, so a context keeps
+ * one arena per frame size (see init_encoder()) and never hands out an
+ * RGB24 sized buffer for a YUV420 frame. Nothing is allocated until a
+ * buffer is asked for.
+ */
+void arena_init(frame_arena *arena, size_t size)
+{
+    if (size < sizeof(void *))
+        size = sizeof(void *);
+
+    arena->slot_size = (size + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN;
+    arena->free_list = NULL;
+    arena->free_count = 0;
+    arena->blocks = NULL;
+    arena->slots = 0;
+}
+
+/**
+ * arena_reserve - Make sure buffers can be handed out without growing
+ * @arena: Frame arena
+ * @count: Number of buffers about to be asked for
+ *
+ * The buffers that are missing are carved as one contiguous block, so a
+ * caller that knows how many frames it holds gets them side by side.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int arena_reserve(frame_arena *arena, int count)
+{
+    if (count <= arena->free_count)
+        return 0;
+
+    return add_block(arena, count - arena->free_count);
+}
+
+/**
+ * arena_alloc - Take a buffer from the arena
+ * @arena: Frame arena
+ *
+ * Freed buffers are reused first, the arena only grows, by ARENA_GROW
+ * buffers at a time, once none are left. The arena is not locked, so
+ * buffers are taken and given back on the thread that owns the context.
+ *
+ * Return: Buffer of arena->slot_size bytes aligned to FRAME_ALIGN, or
+ * NULL on failure
+ */
+unsigned char *arena_alloc(frame_arena *arena)
+{
+    void *slot;
+
+    if (!arena->free_list && add_block(arena, ARENA_GROW) != 0)
+        return NULL;
+
+    slot = arena->free_list;
+    arena->free_list = *(void **)slot;
+    arena->free_count--;
+
+    return slot;
+}
+
+/**
+ * arena_free - Give a buffer back to the arena
+ * @arena: Frame arena
+ * @buf: Buffer from arena_alloc(), or NULL
+ */
+void arena_free(frame_arena *arena, void *buf)
+{
+    if (!buf)
+        return;
+
+    *(void **)buf = arena->free_list;
+    arena->free_list = buf;
+    arena->free_count++;
+}
+
+/**
+ * arena_destroy - Release every block of the arena
+ * @arena: Frame arena
+ *
+ * Buffers still handed out become invalid.
+ */
+void arena_destroy(frame_arena *arena)
+{
+    while (arena->blocks) {
+        void *next = *(void **)arena->blocks;
+
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena->free_list = NULL;
+    arena->free_count = 0;
+    arena->slots = 0;
+}
@@ -0,0 +1,369 @@
+// frame_source.c
+#include "codec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Mapped input is dropped from our address space in steps of this size */
+#define SOURCE_RELEASE_STEP (8 * 1024 * 1024)
+
+/* Longest Y4M stream or frame header line accepted */
+#define Y4M_MAX_HEADER 1024
+
+/**
+ * map_source - Memory map an input file for reading
+ * @src: Source to fill in
+ * @filename: Input filename
+ *
+ * Return: 0 on success, -1 if the file can not be mapped
+ */
+static int map_source(frame_source *src, const char *filename)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    /* frames are read front to back exactly once */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+
+    src->map = map;
+    src->map_size = st.st_size;
+    return 0;
+}
+
+/**
+ * read_line - Read one Y4M header line from a source
+ * @src: Open source
+ * @line: Buffer for the line, stored without its newline
+ * @size: Size of @line
+ *
+ * Return: 0 on success, -1 at end of input or if the line does not fit
+ */
+static int read_line(frame_source *src, char *line, size_t size)
+{
+    size_t len = 0;
+    int c = EOF;
+
+    if (src->map) {
+        size_t left = src->map_size - src->offset;
+        const unsigned char *end = memchr(src->map + src->offset, '\n', left < size ? left : size);
+
+        if (!end)
+            return -1;
+        len = end - (src->map + src->offset);
+        memcpy(line, src->map + src->offset, len);
+        src->offset += len + 1;
+    } else {
+        while (len + 1 < size && (c = fgetc(src->fp)) != EOF && c != '\n')
+            line[len++] = c;
+        if (c != '\n')
+            return -1;
+    }
+    line[len] = '\0';
+
+    return 0;
+}
+
+/**
+ * parse_dimension - Parse the value of a Y4M W or H parameter
+ * @str: Digits after the parameter letter
+ * @value: Pointer to store the value
+ *
+ * Return: 0 on success, -1 if @str is not a number from 1 to MAX_DIMENSION
+ */
+static int parse_dimension(const char *str, int *value)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(str, &end, 10);
+    if (errno || end == str || *end != '\0' || v < 1 || v > MAX_DIMENSION) {
+        fprintf(stderr, "Invalid Y4M frame size %s\n", str);
+        return -1;
+    }
+
+    *value = (int)v;
+    return 0;
+}
+
+/**
+ * parse_y4m_header - Parse the stream header of a Y4M file
+ * @line: Header line, without its newline, modified while parsing
+ * @width: Pointer to store the frame width
+ * @height: Pointer to store the frame height
+ * @fps: Pointer to store the frame rate, 0 when the header has none
+ *
+ * Only 8 bit 4:2:0 is taken. The chroma siting variants all share the
+ * same plane layout, and interlacing and aspect ratio do not change it.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int parse_y4m_header(char *line, int *width, int *height, float *fps)
+{
+    char *save, *tok;
+    int num, den;
+
+    if (strncmp(line, "YUV4MPEG2", 9) != 0 || (line[9] != ' ' && line[9] != '\0'))
+        return -1;
+
+    *width = *height = 0;
+    *fps = 0;
+    for (tok = strtok_r(line + 9, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        switch (tok[0]) {
+        case 'W':
+            if (parse_dimension(tok + 1, width) != 0)
+                return -1;
+            break;
+        case 'H':
+            if (parse_dimension(tok + 1, height) != 0)
+                return -1;
+            break;
+        case 'F':
+            if (sscanf(tok + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0)
+                *fps = (float)num / den;
+            break;
+        case 'C':
+            if (strcmp(tok + 1, "420") != 0 && strcmp(tok + 1, "420jpeg") != 0 &&
+                strcmp(tok + 1, "420paldv") != 0 && strcmp(tok + 1, "420mpeg2") != 0) {
+                fprintf(stderr, "Unsupported Y4M colour space %s\n", tok + 1);
+                return -1;
+            }
+            break;
+        }
+    }
+
+    /* both must be given, and within the same limit as a stream header */
+    return check_frame_size(*width, *height);
+}
+
+/**
+ * setup_source - Finish opening a source once its input is open
+ * @ctx: Encoder context
+ * @src: Source with its file, mapping or pipe open
+ *
+ * Y4M input is sized by its stream header. If the context has no size
+ * yet it is initialised from the header, as stream_decoder_init() does,
+ * otherwise the header must match it.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int setup_source(encoder_context *ctx, frame_source *src)
+{
+    if (src->format == INPUT_Y4M) {
+        char line[Y4M_MAX_HEADER];
+        int width, height;
+        float fps;
+
+        if (read_line(src, line, sizeof(line)) != 0 || parse_y4m_header(line, &width, &height, &fps) != 0) {
+            fprintf(stderr, "Invalid Y4M header\n");
+            return -1;
+        }
+        if (ctx->width == 0) {
+            init_encoder(ctx, width, height);
+            if (fps > 0)
+                ctx->fps = fps;
+        }
+        if (width != ctx->width || height != ctx->height) {
+            fprintf(stderr, "Input is %dx%d, expected %dx%d\n", width, height, ctx->width, ctx->height);
+            return -1;
+        }
+    }
+
+    src->frame_bytes = src->format == INPUT_RGB24 ? ctx->frame_size : ctx->yuv_size;
+    if (!src->map) {
+        src->buffer = malloc(src->frame_bytes);
+        if (!src->buffer)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * open_source - Open a raw video input file
+ * @ctx: Encoder context, may be left unsized for Y4M input
+ * @src: Source to init
+ * @filename: Input filename
+ * @format: Layout of the frames in the file
+ * @use_mmap: Non zero to map the file instead of reading it
+ *
+ * Falls back to buffered reads when the file can not be mapped. YUV420
+ * input skips colour conversion, its frames go to the delta stage as
+ * they are.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int open_source(encoder_context *ctx, frame_source *src, const char *filename, input_format format, int use_mmap)
+{
+    memset(src, 0, sizeof(*src));
+    src->format = format;
+
+    if (!use_mmap || map_source(src, filename) != 0) {
+        src->fp = fopen(filename, "rb");
+        if (!src->fp) {
+            fprintf(stderr, "Error opening input file\n");
+            return -1;
+        }
+    }
+
+    if (setup_source(ctx, src) != 0) {
+        close_source(src);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * open_pipe_source - Read raw frames from the output of a command
+ * @ctx: Encoder context, may be left unsized for Y4M input
+ * @src: Source to init
+ * @command: Shell command writing raw video to its stdout
+ * @format: Layout of the frames the command writes
+ *
+ * Frames are consumed as the command produces them, so decoding and
+ * encoding overlap and nothing is written to disk.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int open_pipe_source(encoder_context *ctx, frame_source *src, const char *command, input_format format)
+{
+    memset(src, 0, sizeof(*src));
+    src->format = format;
+
+    src->fp = popen(command, "r");
+    if (!src->fp) {
+        fprintf(stderr, "Error starting input command\n");
+        return -1;
+    }
+    src->is_pipe = 1;
+
+    if (setup_source(ctx, src) != 0) {
+        close_source(src);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * next_frame_header - Step over the header in front of a Y4M frame
+ * @src: Open Y4M source
+ *
+ * Return: 0 on success, -1 at end of input or on a bad header
+ */
+static int next_frame_header(frame_source *src)
+{
+    char line[Y4M_MAX_HEADER];
+
+    if (read_line(src, line, sizeof(line)) != 0)
+        return -1;
+
+    if (strncmp(line, "FRAME", 5) != 0 || (line[5] != ' ' && line[5] != '\0')) {
+        fprintf(stderr, "Invalid Y4M frame header\n");
+        src->error = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * source_next_frame - Get the next frame from a source
+ * @src: Open source
+ *
+ * For mapped files the pointer is straight into the mapping, so no copy
+ * of the input is made. Pages behind the read position are dropped from
+ * the mapping as we go to keep the resident size flat, unless the caller
+ * set src->hold to keep using earlier frames.
+ *
+ * Return: Pointer to src->frame_bytes bytes of one frame, or NULL at end of input
+ */
+const unsigned char *source_next_frame(frame_source *src)
+{
+    const unsigned char *frame;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t done;
+
+    if (src->format == INPUT_Y4M && next_frame_header(src) != 0)
+        return NULL;
+
+    if (!src->map)
+        return fread(src->buffer, 1, src->frame_bytes, src->fp) == src->frame_bytes ? src->buffer : NULL;
+
+    if (src->map_size - src->offset < src->frame_bytes)
+        return NULL;
+
+    /* the previous frame is finished with once the next one is asked for */
+    done = src->offset / page * page;
+    if (!src->hold && done - src->released >= SOURCE_RELEASE_STEP) {
+        madvise(src->map + src->released, done - src->released, MADV_DONTNEED);
+        src->released = done;
+    }
+
+    frame = src->map + src->offset;
+    src->offset += src->frame_bytes;
+
+    return frame;
+}
+
+/**
+ * source_release_frame - Drop a mapped frame that is finished with
+ * @src: Open source
+ * @frame: Frame returned by source_next_frame()
+ *
+ * For callers holding on to frames (see src->hold), which can release
+ * each one as they finish with it, from any thread. Only pages wholly
+ * inside the frame are dropped. Does nothing for unmapped input.
+ */
+void source_release_frame(frame_source *src, const unsigned char *frame)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)frame + page - 1) / page * page;
+    uintptr_t end = ((uintptr_t)frame + src->frame_bytes) / page * page;
+
+    if (src->map && end > start)
+        madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+/**
+ * close_source - Release a source opened by open_source or open_pipe_source
+ * @src: Source to close
+ *
+ * Return: 0 on success, -1 if the input command failed
+ */
+int close_source(frame_source *src)
+{
+    int ret = 0;
+
+    if (src->map)
+        munmap(src->map, src->map_size);
+    if (src->fp && src->is_pipe)
+        ret = pclose(src->fp) == 0 ? 0 : -1;
+    else if (src->fp)
+        fclose(src->fp);
+    free(src->buffer);
+    memset(src, 0, sizeof(*src));
+
+    return ret;
+}
@@ -2,19 +2,83 @@
 
 #include "codec.h"
 
+/**
+* check_frame_size - Check a frame size before a context is sized from it
+* @width: Width in pixels
+* @height: Height in pixels
+*
+* Sizes come from file headers, so they are untrusted. Within the limit
+* every frame size the codec computes fits in an int as well as a size_t.
+*
+* Return: 0 if the size can be used, -1 otherwise
+*/
+int check_frame_size(int width, int height)
+{
+    if (width < 1 || height < 1 || width > MAX_DIMENSION || height > MAX_DIMENSION ||
+        (size_t)width * height > SIZE_MAX / 3) {
+        fprintf(stderr, "Invalid frame size %dx%d, at most %dx%d\n", width, height, MAX_DIMENSION, MAX_DIMENSION);
+        return -1;
+    }
+
+    return 0;
+}
+
 /**
 * init_encoder - Init the encoder context with given dimensions
 * @ctx: Encoder context to init
 * @width: Video width in pixels
 * @height: video height in pixels
 *
-* Calculates the frame sizes and inits the context struct
+* Calculates the frame sizes and inits the context struct. The size
+* should have passed check_frame_size().
 */
 void init_encoder(encoder_context *ctx, int width, int height)
 {
+    size_t slot;
+
     ctx->width = width;
     ctx->height = height;
-    ctx->frame_size = width * height * 3; // RGB24 format
-    ctx->yuv_size = width * height + (width * height / 2);  // YUV420 format
+    ctx->frame_size = (size_t)width * height * 3; // RGB24 format
+    ctx->chroma_width = (width + 1) / 2;
+    ctx->chroma_height = (height + 1) / 2;
+    ctx->yuv_size = (size_t)width * height + 2 * (size_t)ctx->chroma_width * ctx->chroma_height;  // YUV420 format
+    ctx->gop_size = DEFAULT_GOP_SIZE;
+    set_colour_path(ctx, COLOUR_SIMD);
+    ctx->threads = 1;
+    ctx->pool = NULL;
+
+    /* YUV420 frames are half the size of RGB24 ones, so each gets its own arena */
+    slot = padded_frame_size(ctx, 0);
+    arena_init(&ctx->arena, ctx->frame_size);
+    arena_init(&ctx->yuv_arena, slot > ctx->yuv_size ? slot : ctx->yuv_size);
+}
+
+/**
+* set_threads - Set the number of threads used for colour conversion
+* @ctx: Encoder context
+* @threads: Thread count, 1 converts on the calling thread
+*
+* Return: 0 on success, -1 if the worker threads could not be started
+*/
+int set_threads(encoder_context *ctx, int threads)
+{
+    pool_destroy(ctx->pool);
+    ctx->pool = pool_create(threads);
+    ctx->threads = ctx->pool ? threads : 1;
+
+    return threads > 1 && !ctx->pool ? -1 : 0;
+}
+
+/**
+* free_encoder - Release resources held by the encoder context
+* @ctx: Encoder context
+*/
+void free_encoder(encoder_context *ctx)
+{
+    pool_destroy(ctx->pool);
+    ctx->pool = NULL;
+    ctx->threads = 1;
+    arena_destroy(&ctx->arena);
+    arena_destroy(&ctx->yuv_arena);
 }
 
@@ -10,59 +10,72 @@
 * @frames: pointer to array of frames
 * @frame_count: Pointer to store number of frames read
 *
+* The frames are counted from the file size and taken from ctx->arena as
+* one contiguous block. A trailing partial frame is left out. Give the
+* frames back with arena_free(), which convert_to_yuv420() does as it
+* converts them.
+*
 * Return: 0 on success, -1 on failure
 */
 int read_frames(encoder_context *ctx, const char *filename, video_frame **frames, int *frame_count)
 {
     FILE *fp;
-    unsigned char *buffer;
-    size_t bytes_read;
-    int count = 0;
+    long file_size;
+    int count;
     video_frame *frame_array;
 
     fp = fopen(filename, "rb");
-     if (!fp) {
+    if (!fp) {
         fprintf(stderr, "Error opening input file\n");
         return -1;
     }
 
     /* count frames and allocate memory */
-    buffer = malloc(ctx->frame_size);
-    if (!buffer) {
+    if (fseek(fp, 0, SEEK_END) != 0 || (file_size = ftell(fp)) < 0) {
         fclose(fp);
         return -1;
     }
+    count = file_size / ctx->frame_size;
 
-    while ((bytes_read = fread(buffer, 1, ctx->frame_size, fp)))
-        count++;
-
-    *frame_count = count;
-    frame_array = malloc(count * sizeof(video_frame));
-    if (!frame_array) {
-        free(buffer);
+    frame_array = malloc((count > 0 ? count : 1) * sizeof(video_frame));
+    if (!frame_array || arena_reserve(&ctx->arena, count) != 0) {
+        free(frame_array);
         fclose(fp);
         return -1;
     }
 
-    /* read rfames into array*/
+    /* read frames into array */
     fseek(fp, 0, SEEK_SET);
     for (int i = 0; i < count; i++) {
-        frame_array[i].data = malloc(ctx->frame_size);
-        if (!frame_array[i].data) {
-            for (int j = 0; j < i; j++)
-                 free(frame_array);
+        frame_array[i].data = arena_alloc(&ctx->arena);
+        frame_array[i].size = ctx->frame_size;
+        if (!read_frame(ctx, fp, frame_array[i].data)) {
+            for (int j = 0; j <= i; j++)
+                arena_free(&ctx->arena, frame_array[j].data);
             free(frame_array);
-            free(buffer);
             fclose(fp);
             return -1;
         }
-        frame_array[i].size = ctx->frame_size;
-        fread(frame_array[i].data, 1, ctx->frame_size, fp);
     }
+
     *frames = frame_array;
-    free(buffer);
+    *frame_count = count;
     fclose(fp);
     printf("Done reading file...\n");
     return 0;
 }
 
+/**
+* read_frame - Read the next raw frame from an open stream
+* @ctx: Encoder context
+* @fp: Input stream
+* @rgb: Buffer of ctx->frame_size bytes to fill
+*
+* A trailing partial frame is treated as end of input.
+*
+* Return: 1 if a frame was read, 0 at end of input
+*/
+int read_frame(encoder_context *ctx, FILE *fp, unsigned char *rgb)
+{
+    return fread(rgb, 1, ctx->frame_size, fp) == ctx->frame_size;
+}
@@ -0,0 +1,249 @@
+// stream_decoder.c
+#include "codec.h"
+
+/**
+ * stream_decoder_init - Set up a frame at a time decoder
+ * @dec: Stream decoder to init
+ * @ctx: Encoder context, its size must match the stream; with a width of
+ * 0 it is set up by init_encoder() from the stream header instead
+ * @in: Encoded stream, read front to back so it may be a pipe
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int stream_decoder_init(stream_decoder *dec, encoder_context *ctx, FILE *in)
+{
+    unsigned char buf[STREAM_HEADER_SIZE];
+
+    memset(dec, 0, sizeof(*dec));
+    dec->ctx = ctx;
+    dec->in = in;
+
+    if (fread(buf, sizeof(buf), 1, in) != 1 || parse_stream_header(buf, &dec->hdr) != 0)
+        return -1;
+    if (ctx->width == 0) {
+        init_encoder(ctx, dec->hdr.width, dec->hdr.height);
+        ctx->fps = dec->hdr.fps_den ? (float)dec->hdr.fps_num / dec->hdr.fps_den : 0;
+        ctx->gop_size = dec->hdr.gop_size;
+    }
+    if (dec->hdr.width != ctx->width || dec->hdr.height != ctx->height) {
+        fprintf(stderr, "Stream is %dx%d, expected %dx%d\n", dec->hdr.width, dec->hdr.height, ctx->width, ctx->height);
+        return -1;
+    }
+
+    /* fields a later version adds to the header */
+    for (int i = STREAM_HEADER_SIZE; i < dec->hdr.header_size; i++) {
+        if (fgetc(in) == EOF)
+            return -1;
+    }
+
+    /* init zlib */
+    dec->strm.zalloc = Z_NULL;
+    dec->strm.zfree = Z_NULL;
+    dec->strm.opaque = Z_NULL;
+    dec->strm.avail_in = 0;
+    dec->strm.next_in = Z_NULL;
+    if (inflateInit(&dec->strm) != Z_OK)
+        return -1;
+    dec->strm_open = 1;
+
+    dec->frame = arena_alloc(&ctx->yuv_arena);
+    dec->in_buf = malloc(STREAM_CHUNK);
+    dec->delta = malloc(FUSE_BYTES);
+    if (!dec->frame || !dec->in_buf || !dec->delta) {
+        stream_decoder_free(dec);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * inflate_exact - Inflate exactly @size bytes of the current chunk
+ * @dec: Stream decoder
+ * @out: Output buffer
+ * @size: Number of bytes to inflate
+ *
+ * Return: 0 on success, -1 if the chunk ends early or is damaged
+ */
+static int inflate_exact(stream_decoder *dec, unsigned char *out, size_t size)
+{
+    z_stream *strm = &dec->strm;
+    int ret;
+
+    strm->next_out = out;
+    strm->avail_out = size;
+
+    while (strm->avail_out > 0) {
+        if (strm->avail_in == 0) {
+            size_t want = dec->chunk_bytes < STREAM_CHUNK ? dec->chunk_bytes : STREAM_CHUNK;
+            size_t got = want ? fread(dec->in_buf, 1, want, dec->in) : 0;
+
+            if (got == 0)
+                return -1;
+            dec->chunk_bytes -= got;
+            strm->next_in = dec->in_buf;
+            strm->avail_in = got;
+        }
+
+        ret = inflate(strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END && strm->avail_out > 0)
+            return -1;
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * next_chunk - Skip what is left of the current chunk and start the next
+ * @dec: Stream decoder
+ *
+ * Return: 1 if a chunk was started, 0 at the end of the chunks, -1 on failure
+ */
+static int next_chunk(stream_decoder *dec)
+{
+    unsigned char buf[CHUNK_HEADER_SIZE];
+    chunk_header hdr;
+
+    /* the zlib trailer is not needed once all frames are out */
+    while (dec->chunk_bytes > 0) {
+        size_t want = dec->chunk_bytes < STREAM_CHUNK ? dec->chunk_bytes : STREAM_CHUNK;
+
+        if (fread(dec->in_buf, 1, want, dec->in) != want)
+            return -1;
+        dec->chunk_bytes -= want;
+    }
+
+    if (fread(buf, sizeof(buf), 1, dec->in) != 1)
+        return feof(dec->in) ? 0 : -1;
+    parse_chunk_header(buf, &hdr);
+    if (hdr.frames == 0)
+        return 0;
+
+    dec->chunk_bytes = hdr.size;
+    dec->frames_left = hdr.frames;
+    dec->strm.avail_in = 0;
+    dec->strm.next_in = Z_NULL;
+
+    return inflateReset(&dec->strm) == Z_OK ? 1 : -1;
+}
+
+/**
+ * decoder_next_frame - Decode the next frame of the stream
+ * @dec: Stream decoder
+ *
+ * Only the current frame is kept, it is the reference for the next one.
+ * Deltas are inflated a FUSE_BYTES slice at a time and added into it
+ * straight away, so memory use does not depend on the length of the
+ * stream and each frame is out as soon as its bytes have been read.
+ *
+ * Return: The YUV420 frame, valid until the next call, or NULL at the end
+ * of the stream or on failure, which sets dec->error
+ */
+const unsigned char *decoder_next_frame(stream_decoder *dec)
+{
+    size_t size = dec->ctx->yuv_size;
+    int key = 0;
+
+    if (dec->frames_left == 0) {
+        int ret = next_chunk(dec);
+
+        if (ret <= 0) {
+            dec->error = ret < 0;
+            return NULL;
+        }
+        key = 1;
+    }
+
+    if (key) {
+        if (inflate_exact(dec, dec->frame, size) != 0)
+            goto fail;
+    } else {
+        for (size_t off = 0; off < size; off += FUSE_BYTES) {
+            size_t n = size - off < FUSE_BYTES ? size - off : FUSE_BYTES;
+
+            if (inflate_exact(dec, dec->delta, n) != 0)
+                goto fail;
+            add_frame(dec->frame + off, dec->delta, dec->frame + off, n);
+        }
+    }
+
+    dec->frames_left--;
+    dec->frame_count++;
+
+    return dec->frame;
+
+fail:
+    fprintf(stderr, "Error decoding frame %d\n", dec->frame_count);
+    dec->error = 1;
+    dec->frames_left = 0;
+    return NULL;
+}
+
+/**
+ * stream_decoder_seek - Move a decoder to any frame of a seekable stream
+ * @dec: Stream decoder
+ * @frame: Frame the next decoder_next_frame() call returns
+ *
+ * The chunk index gives the key frame at or before @frame. Decoding
+ * starts again from there, and the frames ahead of @frame are decoded
+ * but not returned, so this costs at most one group of pictures however
+ * far into the stream @frame is. The decoder then carries on from @frame
+ * as usual, so a run of frames of any length is read in one pass.
+ *
+ * Return: 0 on success, -1 if the stream is not seekable, has no intact
+ * index or @frame is out of range, which sets dec->error
+ */
+int stream_decoder_seek(stream_decoder *dec, int frame)
+{
+    stream_header hdr;
+    stream_footer ftr;
+    chunk_entry *index;
+    int chunk;
+
+    dec->error = 1;
+    if (read_stream_index(dec->in, &hdr, &ftr, &index) != 0)
+        return -1;
+    if (frame < 0 || frame >= ftr.frame_count) {
+        fprintf(stderr, "Frame %d out of range, stream has %d\n", frame, ftr.frame_count);
+        free(index);
+        return -1;
+    }
+
+    chunk = find_chunk(index, ftr.chunk_count, frame);
+    if (fseeko(dec->in, index[chunk].offset, SEEK_SET) != 0) {
+        free(index);
+        return -1;
+    }
+    dec->frame_count = index[chunk].first_frame;
+    free(index);
+
+    /* the next call reads the chunk header at the key frame */
+    dec->chunk_bytes = 0;
+    dec->frames_left = 0;
+    dec->error = 0;
+    while (dec->frame_count < frame) {
+        if (!decoder_next_frame(dec)) {
+            dec->error = 1;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * stream_decoder_free - Release a stream decoder
+ * @dec: Stream decoder
+ */
+void stream_decoder_free(stream_decoder *dec)
+{
+    if (dec->strm_open)
+        inflateEnd(&dec->strm);
+    dec->strm_open = 0;
+    arena_free(&dec->ctx->yuv_arena, dec->frame);
+    free(dec->in_buf);
+    free(dec->delta);
+    dec->frame = dec->in_buf = dec->delta = NULL;
+}
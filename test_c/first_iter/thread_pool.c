@@ -0,0 +1,144 @@
+// thread_pool.c
+#include "codec.h"
+
+/**
+ * pool_work - Run tasks of the current batch until none are left
+ * @pool: Thread pool, locked by the caller
+ *
+ * The lock is dropped while a task runs.
+ */
+static void pool_work(thread_pool *pool)
+{
+    while (pool->next < pool->total) {
+        int index = pool->next++;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->arg, index);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+/**
+ * pool_worker - Worker thread main loop
+ * @data: Thread pool
+ *
+ * Return: NULL
+ */
+static void *pool_worker(void *data)
+{
+    thread_pool *pool = data;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->batch == seen)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->stop)
+            break;
+
+        seen = pool->batch;
+        pool_work(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * pool_create - Start a pool of worker threads
+ * @threads: Total number of threads to run tasks on, including the caller
+ *
+ * Return: New pool, or NULL when @threads is 1 or less or on failure, in
+ * which case pool_run() runs tasks on the calling thread
+ */
+thread_pool *pool_create(int threads)
+{
+    thread_pool *pool;
+
+    if (threads <= 1)
+        return NULL;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->threads = malloc((threads - 1) * sizeof(pthread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* the thread calling pool_run() takes tasks as well */
+    for (pool->count = 0; pool->count < threads - 1; pool->count++) {
+        if (pthread_create(&pool->threads[pool->count], NULL, pool_worker, pool) != 0)
+            break;
+    }
+
+    if (pool->count == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/**
+ * pool_run - Run a batch of tasks and wait for all of them
+ * @pool: Thread pool, or NULL to run on the calling thread
+ * @task: Function called once per task
+ * @arg: Argument passed to every call of @task
+ * @count: Number of tasks, each call gets an index in 0..count-1
+ */
+void pool_run(thread_pool *pool, pool_task task, void *arg, int count)
+{
+    if (!pool) {
+        for (int i = 0; i < count; i++)
+            task(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->next = 0;
+    pool->total = count;
+    pool->pending = count;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work);
+
+    pool_work(pool);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * pool_destroy - Stop the worker threads and free the pool
+ * @pool: Thread pool, may be NULL
+ */
+void pool_destroy(thread_pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,395 @@
+// vcodec.c
+#define _GNU_SOURCE /* fopencookie() */
+#include "codec.h"
+#include "vcodec.h"
+#include <sys/types.h>
+
+/* an encoder handle, everything the encoder needs lives in one allocation */
+struct vc_encoder {
+    encoder_context ctx;
+    stream_encoder enc;
+    FILE *out;
+    vc_format format;
+    vc_write_fn write;
+    void *opaque;
+    unsigned char *rgb;
+    int flushed;
+};
+
+/* a decoder handle */
+struct vc_decoder {
+    encoder_context ctx;
+    stream_decoder dec;
+    FILE *in;
+    vc_format format;
+    vc_read_fn read;
+    void *opaque;
+    unsigned char *rgb;
+};
+
+/**
+ * cookie_write - Hand bytes written to the output stream to the caller
+ * @cookie: Encoder handle
+ * @buf: Bytes written
+ * @size: Number of bytes
+ *
+ * Return: @size on success, 0 on failure, which fails the write
+ */
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size)
+{
+    vc_encoder *ve = cookie;
+
+    return ve->write(ve->opaque, (const unsigned char *)buf, size) == 0 ? (ssize_t)size : 0;
+}
+
+/**
+ * cookie_read - Fill the input stream from the caller
+ * @cookie: Decoder handle
+ * @buf: Buffer to fill
+ * @size: Bytes wanted
+ *
+ * Return: Number of bytes stored, 0 at the end
+ */
+static ssize_t cookie_read(void *cookie, char *buf, size_t size)
+{
+    vc_decoder *vd = cookie;
+
+    return vd->read(vd->opaque, (unsigned char *)buf, size);
+}
+
+/**
+ * wrap_planes - Describe frame planes owned by the caller
+ * @ctx: Encoder context
+ * @planes: Y, U and V planes
+ * @strides: Bytes from one row of each plane to the next
+ * @frame: Descriptor to fill in
+ *
+ * Return: 0 on success, -1 if a plane is missing or a stride too short
+ */
+static int wrap_planes(encoder_context *ctx, unsigned char *const planes[3], const int strides[3], yuv_frame *frame)
+{
+    frame->data = planes[0];
+    frame->border = 0;
+
+    for (int p = 0; p < 3; p++) {
+        frame->plane[p] = planes[p];
+        frame->stride[p] = strides[p];
+        frame->width[p] = p ? ctx->chroma_width : ctx->width;
+        frame->height[p] = p ? ctx->chroma_height : ctx->height;
+
+        if (!planes[p] || strides[p] < frame->width[p]) {
+            fprintf(stderr, "Plane %d missing or its stride is too short\n", p);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * copy_rgb_rows - Copy an RGB24 frame between row layouts
+ * @ctx: Encoder context
+ * @dst: Destination frame
+ * @dst_stride: Bytes per row of @dst
+ * @src: Source frame
+ * @src_stride: Bytes per row of @src
+ */
+static void copy_rgb_rows(encoder_context *ctx, unsigned char *dst, size_t dst_stride, const unsigned char *src,
+                          size_t src_stride)
+{
+    for (int i = 0; i < ctx->height; i++)
+        memcpy(dst + i * dst_stride, src + i * src_stride, (size_t)ctx->width * 3);
+}
+
+/**
+ * check_format - Check a frame format is one the library knows
+ * @format: Format from the caller's params
+ *
+ * Return: 0 if it is, -1 otherwise
+ */
+static int check_format(vc_format format)
+{
+    if (format != VC_FORMAT_YUV420P && format != VC_FORMAT_RGB24) {
+        fprintf(stderr, "Unknown frame format %d\n", (int)format);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * vc_encoder_create - Start encoding a stream
+ * @params: Encoder settings
+ *
+ * The stream header is written straight away. Every piece of the stream
+ * goes to params->write as soon as it is ready, in order, and nothing is
+ * held back in a stdio buffer.
+ *
+ * Return: Encoder handle, or NULL on failure
+ */
+vc_encoder *vc_encoder_create(const vc_encoder_params *params)
+{
+    cookie_io_functions_t io = {NULL, cookie_write, NULL, NULL};
+    vc_encoder *ve;
+
+    if (!params->write) {
+        fprintf(stderr, "Encoder needs a write callback\n");
+        return NULL;
+    }
+    if (check_format(params->format) != 0 || check_frame_size(params->width, params->height) != 0)
+        return NULL;
+
+    ve = calloc(1, sizeof(*ve));
+    if (!ve)
+        return NULL;
+    ve->format = params->format;
+    ve->write = params->write;
+    ve->opaque = params->opaque;
+
+    init_encoder(&ve->ctx, params->width, params->height);
+    ve->ctx.fps = params->fps > 0 ? params->fps : DEFAULT_FPS;
+    if (params->gop_size > 0)
+        ve->ctx.gop_size = params->gop_size;
+    if (params->threads > 1 && set_threads(&ve->ctx, params->threads) != 0)
+        goto fail;
+
+    ve->out = fopencookie(ve, "wb", io);
+    if (!ve->out || setvbuf(ve->out, NULL, _IONBF, 0) != 0)
+        goto fail;
+    if (stream_encoder_init(&ve->enc, &ve->ctx, ve->out) != 0) {
+        stream_encoder_free(&ve->enc);
+        goto fail;
+    }
+
+    return ve;
+
+fail:
+    if (ve->out)
+        fclose(ve->out);
+    free_encoder(&ve->ctx);
+    free(ve);
+    return NULL;
+}
+
+/**
+ * vc_encode_frame - Push one frame into the encoder
+ * @enc: Encoder handle
+ * @planes: Y, U and V planes for yuv420p, or the RGB24 frame in planes[0]
+ * @strides: Bytes from one row of each plane to the next
+ *
+ * The frame is copied, so the planes may be reused once this returns.
+ * Frames come out of params->write a group of pictures at a time. With
+ * more than one thread they are queued, converted to YUV420, until there
+ * is a group for every thread, or as many as fit in PUSH_BATCH_BYTES, and
+ * the groups are compressed in parallel and written in order. Otherwise
+ * each frame is compressed as it is pushed, see stream_encoder_init().
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int vc_encode_frame(vc_encoder *enc, const unsigned char *const planes[3], const int strides[3])
+{
+    encoder_context *ctx = &enc->ctx;
+    size_t row = (size_t)ctx->width * 3;
+    yuv_frame frame;
+
+    if (enc->flushed) {
+        fprintf(stderr, "Frame pushed after the stream was flushed\n");
+        return -1;
+    }
+
+    if (enc->format == VC_FORMAT_YUV420P) {
+        if (wrap_planes(ctx, (unsigned char *const *)planes, strides, &frame) != 0)
+            return -1;
+        return stream_encode_yuv_frame(&enc->enc, &frame);
+    }
+
+    if (!planes[0] || strides[0] < (int)row) {
+        fprintf(stderr, "RGB24 plane missing or its stride is too short\n");
+        return -1;
+    }
+    if ((size_t)strides[0] == row)
+        return stream_encode_frame(&enc->enc, planes[0]);
+
+    /* the conversion reads packed rows */
+    if (!enc->rgb && !(enc->rgb = arena_alloc(&ctx->arena)))
+        return -1;
+    copy_rgb_rows(ctx, enc->rgb, row, planes[0], strides[0]);
+
+    return stream_encode_frame(&enc->enc, enc->rgb);
+}
+
+/**
+ * vc_flush - Finish the stream
+ * @enc: Encoder handle
+ *
+ * Writes the frames still held and the chunk index, after which the
+ * stream is complete. No more frames can be pushed.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+int vc_flush(vc_encoder *enc)
+{
+    if (enc->flushed)
+        return 0;
+    enc->flushed = 1;
+
+    return stream_encoder_finish(&enc->enc) == 0 && fflush(enc->out) == 0 ? 0 : -1;
+}
+
+/**
+ * vc_encoder_frame_count - Number of frames pushed so far
+ * @enc: Encoder handle
+ *
+ * Return: Frame count
+ */
+int vc_encoder_frame_count(const vc_encoder *enc)
+{
+    return enc->enc.frame_count;
+}
+
+/**
+ * vc_encoder_destroy - Release an encoder
+ * @enc: Encoder handle, or NULL
+ *
+ * A stream that was not flushed first is left without its last frames
+ * and index.
+ */
+void vc_encoder_destroy(vc_encoder *enc)
+{
+    if (!enc)
+        return;
+
+    stream_encoder_free(&enc->enc);
+    arena_free(&enc->ctx.arena, enc->rgb);
+    fclose(enc->out);
+    free_encoder(&enc->ctx);
+    free(enc);
+}
+
+/**
+ * vc_decoder_create - Start decoding a stream
+ * @params: Decoder settings
+ *
+ * The stream header is read straight away, see vc_decoder_info().
+ *
+ * Return: Decoder handle, or NULL on failure
+ */
+vc_decoder *vc_decoder_create(const vc_decoder_params *params)
+{
+    cookie_io_functions_t io = {cookie_read, NULL, NULL, NULL};
+    vc_decoder *vd;
+
+    if (!params->read) {
+        fprintf(stderr, "Decoder needs a read callback\n");
+        return NULL;
+    }
+    if (check_format(params->format) != 0)
+        return NULL;
+
+    vd = calloc(1, sizeof(*vd));
+    if (!vd)
+        return NULL;
+    vd->format = params->format;
+    vd->read = params->read;
+    vd->opaque = params->opaque;
+
+    vd->in = fopencookie(vd, "rb", io);
+    if (!vd->in)
+        goto fail;
+
+    /* a width of 0 sizes the context from the stream header */
+    if (stream_decoder_init(&vd->dec, &vd->ctx, vd->in) != 0) {
+        fprintf(stderr, "Error reading stream header\n");
+        stream_decoder_free(&vd->dec);
+        goto fail;
+    }
+    if (params->threads > 1 && set_threads(&vd->ctx, params->threads) != 0) {
+        stream_decoder_free(&vd->dec);
+        goto fail;
+    }
+
+    return vd;
+
+fail:
+    if (vd->in)
+        fclose(vd->in);
+    free_encoder(&vd->ctx);
+    free(vd);
+    return NULL;
+}
+
+/**
+ * vc_decoder_info - Describe the stream being decoded
+ * @dec: Decoder handle
+ * @info: Pointer to store what the stream header says
+ */
+void vc_decoder_info(const vc_decoder *dec, vc_stream_info *info)
+{
+    info->width = dec->ctx.width;
+    info->height = dec->ctx.height;
+    info->fps = dec->ctx.fps;
+    info->gop_size = dec->ctx.gop_size;
+}
+
+/**
+ * vc_decode_frame - Pull the next frame out of the decoder
+ * @dec: Decoder handle
+ * @planes: Y, U and V planes for yuv420p, or the RGB24 frame in planes[0]
+ * @strides: Bytes from one row of each plane to the next
+ *
+ * The frame is written into the caller's planes, which only need to
+ * hold the visible samples of each row.
+ *
+ * Return: 1 if a frame was decoded, 0 at the end of the stream, -1 on
+ * failure
+ */
+int vc_decode_frame(vc_decoder *dec, unsigned char *const planes[3], const int strides[3])
+{
+    encoder_context *ctx = &dec->ctx;
+    size_t row = (size_t)ctx->width * 3;
+    const unsigned char *yuv;
+    yuv_frame src, dst;
+
+    if (dec->format == VC_FORMAT_YUV420P) {
+        if (wrap_planes(ctx, planes, strides, &dst) != 0)
+            return -1;
+    } else if (!planes[0] || strides[0] < (int)row) {
+        fprintf(stderr, "RGB24 plane missing or its stride is too short\n");
+        return -1;
+    }
+
+    yuv = decoder_next_frame(&dec->dec);
+    if (!yuv)
+        return dec->dec.error ? -1 : 0;
+    init_packed_frame(ctx, yuv, &src);
+
+    if (dec->format == VC_FORMAT_YUV420P) {
+        copy_frame_planes(&dst, &src);
+    } else if ((size_t)strides[0] == row) {
+        yuv420_to_rgb(ctx, &src, planes[0]);
+    } else {
+        /* the conversion writes packed rows */
+        if (!dec->rgb && !(dec->rgb = arena_alloc(&ctx->arena)))
+            return -1;
+        yuv420_to_rgb(ctx, &src, dec->rgb);
+        copy_rgb_rows(ctx, planes[0], strides[0], dec->rgb, row);
+    }
+
+    return 1;
+}
+
+/**
+ * vc_decoder_destroy - Release a decoder
+ * @dec: Decoder handle, or NULL
+ */
+void vc_decoder_destroy(vc_decoder *dec)
+{
+    if (!dec)
+        return;
+
+    stream_decoder_free(&dec->dec);
+    arena_free(&dec->ctx.arena, dec->rgb);
+    fclose(dec->in);
+    free_encoder(&dec->ctx);
+    free(dec);
+}
@@ -0,0 +1,119 @@
+#ifndef VCODEC_H /*VCODEC_H*/
+#define VCODEC_H
+
+/*
+ * libvcodec, the codec as a library. Frames are pushed into an encoder
+ * and pulled out of a decoder in memory, the encoded stream goes through
+ * callbacks, so no files or processes are involved. The stream is the
+ * same container vid_codec writes. See vcodec.c for the functions.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vc_encoder vc_encoder;
+typedef struct vc_decoder vc_decoder;
+
+/* layouts of the frames pushed to an encoder or pulled from a decoder */
+typedef enum {
+	VC_FORMAT_YUV420P,	/* Y, U and V planes, U and V half the size rounded up, no conversion */
+	VC_FORMAT_RGB24		/* one plane of packed R, G and B bytes */
+} vc_format;
+
+/**
+ * vc_write_fn - Take the next bytes of an encoded stream
+ * @opaque: Pointer given in the encoder params
+ * @data: Bytes to write
+ * @size: Number of bytes
+ *
+ * Return: 0 on success, -1 on failure
+ */
+typedef int (*vc_write_fn)(void *opaque, const unsigned char *data, size_t size);
+
+/**
+ * vc_read_fn - Give the next bytes of an encoded stream
+ * @opaque: Pointer given in the decoder params
+ * @data: Buffer to fill
+ * @size: Bytes wanted
+ *
+ * Like fread(), fewer bytes than asked for are only returned at the end
+ * of the stream.
+ *
+ * Return: Number of bytes stored, 0 at the end or on failure
+ */
+typedef size_t (*vc_read_fn)(void *opaque, unsigned char *data, size_t size);
+
+/**
+ * @struct vc_encoder_params
+ * @brief: Settings of a new encoder, 0 picks the default where there is one
+ *
+ * @param width: Frame width in pixels
+ * @param height: Frame height in pixels
+ * @param fps: Frame rate stored in the stream (default 25)
+ * @param gop_size: Key frame and compressed chunk every N frames (default 50)
+ * @param threads: Threads for conversion and compression (default 1)
+ * @param format: Layout of the frames passed to vc_encode_frame(), one of vc_format
+ * @param write: Called with the encoded stream, front to back
+ * @param opaque: Passed to @write
+ */
+typedef struct {
+	int width;
+	int height;
+	double fps;
+	int gop_size;
+	int threads;
+	vc_format format;
+	vc_write_fn write;
+	void *opaque;
+} vc_encoder_params;
+
+/**
+ * @struct vc_decoder_params
+ * @brief: Settings of a new decoder, 0 picks the default where there is one
+ *
+ * @param threads: Threads for colour conversion (default 1)
+ * @param format: Layout of the frames vc_decode_frame() returns, one of vc_format
+ * @param read: Called for the encoded stream, front to back
+ * @param opaque: Passed to @read
+ */
+typedef struct {
+	int threads;
+	vc_format format;
+	vc_read_fn read;
+	void *opaque;
+} vc_decoder_params;
+
+/**
+ * @struct vc_stream_info
+ * @brief: What the header of an encoded stream says
+ *
+ * @param width: Frame width in pixels
+ * @param height: Frame height in pixels
+ * @param fps: Frame rate, 0 if unknown
+ * @param gop_size: Frames per key frame
+ */
+typedef struct {
+	int width;
+	int height;
+	double fps;
+	int gop_size;
+} vc_stream_info;
+
+vc_encoder *vc_encoder_create(const vc_encoder_params *params);
+int vc_encode_frame(vc_encoder *enc, const unsigned char *const planes[3], const int strides[3]);
+int vc_flush(vc_encoder *enc);
+int vc_encoder_frame_count(const vc_encoder *enc);
+void vc_encoder_destroy(vc_encoder *enc);
+vc_decoder *vc_decoder_create(const vc_decoder_params *params);
+void vc_decoder_info(const vc_decoder *dec, vc_stream_info *info);
+int vc_decode_frame(vc_decoder *dec, unsigned char *const planes[3], const int strides[3]);
+void vc_decoder_destroy(vc_decoder *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VCODEC_H */
@@ -1,62 +1,189 @@
 // vid_codec.c
 #include "codec.h"
+#include <unistd.h>
 
 /**
- * main - Entry point
- * @argc: Argument count
- * @argv: Argument array
- * 
- * Return: 0 on success, 1 on failure
+ * print_usage - Print program usage information
+ * @program_name: Name of the program
  */
-int main(int argc, char **argv)
+static void print_usage(const char *program_name)
 {
-    encoder_context ctx;
-    video_frame *frames;
-    int frame_count;
-    unsigned char *compressed;
-    size_t compressed_size;
+    printf("Usage: %s [options] [input_file [output_file]]\n", program_name);
+    printf("Options:\n");
+    printf("  -f    Input format: rgb24, yuv420p or y4m (default: from the file extension)\n");
+    printf("  -s WxH  Frame size of raw input (default: %dx%d, y4m carries its own)\n", DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    printf("  -m    Memory map the input file\n");
+    printf("  -c    Colour conversion: simd (default), fixed or float\n");
+    printf("  -t N  Threads for conversion and compression (default: 1)\n");
+    printf("  -g N  Key frame and compressed chunk every N frames (default: %d)\n", DEFAULT_GOP_SIZE);
+    printf("Defaults: video.rgb24 encoded.bin\n");
+}
+
+/**
+ * format_from_name - Guess the input format from a file extension
+ * @filename: Input filename
+ *
+ * Return: INPUT_Y4M for .y4m, INPUT_YUV420P for .yuv, INPUT_RGB24 otherwise
+ */
+static input_format format_from_name(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext && strcmp(ext, ".y4m") == 0)
+        return INPUT_Y4M;
+    if (ext && strcmp(ext, ".yuv") == 0)
+        return INPUT_YUV420P;
 
-    /* init the encoder */
-    init_encoder(&ctx, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+    return INPUT_RGB24;
+}
+
+/**
+ * encode_file - Encode a whole source, one frame at a time
+ * @ctx: Encoder context
+ * @src: Open source
+ * @output: Output filename
+ *
+ * Return: 0 on success, 1 on failure
+ */
+static int encode_file(encoder_context *ctx, frame_source *src, const char *output)
+{
+    FILE *out;
+    int frame_count = 0;
+    long compressed_size;
 
-    /* read input frames */
-    if (read_frames(&ctx, "video.rgb24", &frames, &frame_count) != 0)
+    out = fopen(output, "wb");
+    if (!out)
     {
-        fprintf(stderr, "Failed to read input from video\n");
+        fprintf(stderr, "Error opening output file\n");
         return 1;
     }
 
-    printf("Reading %d frames\n", frame_count);
-
-    /* convert frames to yuv420 */
-    printf("converting to yuv420 ...\n");
-    for (int i = 0; i < frame_count; i++)
-        convert_to_yuv420(&ctx, &frames[i]);
-    
-    printf("Creating delta frames...\n");
-    create_delta_frames(frames, frame_count);
-
-    printf("compressing the frames ....\n");
-    compressed = compressed_frames(frames, frame_count, &compressed_size);
-    if (!compressed)
+    printf("encoding %dx%d frames ....\n", ctx->width, ctx->height);
+    if (encode_stream(ctx, src, out, &frame_count) != 0)
     {
         fprintf(stderr, "Compression failed\n");
+        fclose(out);
         return 1;
     }
 
-    printf("Compressed size: %zu bytes (%.2f%% of original size)\n", compressed_size, 100.0f * compressed_size / (ctx.frame_size * frame_count));
+    compressed_size = ftell(out);
+    fclose(out);
 
-    FILE *fp = fopen("encoded.bin", "wb");
-    if (fp)
+    printf("Encoded %d frames\n", frame_count);
+    if (frame_count > 0)
+        printf("Compressed size: %ld bytes (%.2f%% of original size)\n", compressed_size, 100.0f * compressed_size / (src->frame_bytes * frame_count));
+
+    return 0;
+}
+
+/**
+ * main - Entry point
+ * @argc: Argument count
+ * @argv: Argument array
+ *
+ * Return: 0 on success, 1 on failure
+ */
+int main(int argc, char **argv)
+{
+    encoder_context ctx;
+    frame_source src;
+    const char *input = "video.rgb24";
+    const char *output = "encoded.bin";
+    int format = -1;
+    int width = DEFAULT_WIDTH;
+    int height = DEFAULT_HEIGHT;
+    int use_mmap = 0;
+    colour_path colour = COLOUR_SIMD;
+    int threads = 1;
+    int gop_size = DEFAULT_GOP_SIZE;
+    int ret;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:s:mc:t:g:")) != -1)
     {
-        fwrite(compressed, 1, compressed_size, fp);
-        fclose(fp);
+        switch (opt)
+        {
+            case 'f':
+                if (strcmp(optarg, "rgb24") == 0)
+                    format = INPUT_RGB24;
+                else if (strcmp(optarg, "yuv420p") == 0)
+                    format = INPUT_YUV420P;
+                else if (strcmp(optarg, "y4m") == 0)
+                    format = INPUT_Y4M;
+                else
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || check_frame_size(width, height) != 0)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                use_mmap = 1;
+                break;
+            case 'c':
+                if (strcmp(optarg, "simd") == 0)
+                    colour = COLOUR_SIMD;
+                else if (strcmp(optarg, "fixed") == 0)
+                    colour = COLOUR_FIXED;
+                else if (strcmp(optarg, "float") == 0)
+                    colour = COLOUR_FLOAT;
+                else
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'g':
+                gop_size = atoi(optarg);
+                if (gop_size < 1)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
     }
+    if (optind < argc)
+        input = argv[optind++];
+    if (optind < argc)
+        output = argv[optind++];
 
-    for (int i = 0; i < frame_count; i++)
-        free(frames[i].data);
-    free(frames);
-    free(compressed);
+    if (format < 0)
+        format = format_from_name(input);
 
-    return 0;
+    /* init the encoder, y4m input sizes it from its header */
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fps = DEFAULT_FPS;
+    if (format != INPUT_Y4M)
+        init_encoder(&ctx, width, height);
+    if (open_source(&ctx, &src, input, format, use_mmap) != 0)
+        return 1;
+
+    ctx.gop_size = gop_size;
+    set_colour_path(&ctx, colour);
+    if (set_threads(&ctx, threads) != 0)
+        fprintf(stderr, "Could not start worker threads, encoding on one\n");
+
+    ret = encode_file(&ctx, &src, output);
+    close_source(&src);
+    free_encoder(&ctx);
+
+    return ret;
 }
@@ -0,0 +1,433 @@
+// vid_decode.c
+#include "codec.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+/* an encoded file mapped whole, for decoding on the worker pool */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    stream_header hdr;
+    stream_footer ftr;
+    chunk_entry *index;
+} mapped_stream;
+
+/**
+ * print_usage - Print program usage information
+ * @program_name: Name of the program
+ */
+static void print_usage(const char *program_name)
+{
+    printf("Usage: %s [options] [input_file [output_file]]\n", program_name);
+    printf("Options:\n");
+    printf("  -f    Output format: rgb24 (default), yuv420p or nv12\n");
+    printf("  -c    Colour conversion for rgb24: simd (default), fixed or float\n");
+    printf("  -t N  Threads for decoding and colour conversion (default: 1)\n");
+    printf("  -r FIRST[:COUNT]  Decode only COUNT frames from frame FIRST, to the end if no COUNT\n");
+    printf("Defaults: encoded.bin decoded.rgb24, - for stdin or stdout\n");
+}
+
+/**
+ * parse_range - Parse the argument of -r
+ * @arg: FIRST or FIRST:COUNT
+ * @first: Pointer to store the first frame
+ * @count: Pointer to store the frame count, 0 for the rest of the stream
+ *
+ * Return: 0 on success, -1 if @arg is not a frame number and optional
+ * positive count
+ */
+static int parse_range(const char *arg, int *first, int *count)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(arg, &end, 10);
+    if (errno || end == arg || v < 0 || v > INT_MAX || (*end != '\0' && *end != ':'))
+        return -1;
+    *first = (int)v;
+    *count = 0;
+    if (*end == '\0')
+        return 0;
+
+    arg = end + 1;
+    v = strtol(arg, &end, 10);
+    if (errno || end == arg || v < 1 || v > INT_MAX || *end != '\0')
+        return -1;
+    *count = (int)v;
+
+    return 0;
+}
+
+/**
+ * setup_context - Size a context from a stream header
+ * @ctx: Unsized encoder context
+ * @hdr: Parsed stream header
+ *
+ * For inputs read without a stream decoder, set up as
+ * stream_decoder_init() does.
+ */
+static void setup_context(encoder_context *ctx, const stream_header *hdr)
+{
+    init_encoder(ctx, hdr->width, hdr->height);
+    ctx->fps = hdr->fps_den ? (float)hdr->fps_num / hdr->fps_den : 0;
+    ctx->gop_size = hdr->gop_size;
+}
+
+/**
+ * map_stream - Map an encoded file whole, with its chunk index
+ * @input: Encoded input filename
+ * @ms: Mapped stream to fill in
+ *
+ * Return: 0 on success, -1 if the file is not a regular file or has no
+ * intact index, e.g. it was cut short, so it must be decoded serially
+ */
+static int map_stream(const char *input, mapped_stream *ms)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(ms, 0, sizeof(*ms));
+    fd = open(input, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < STREAM_HEADER_SIZE + STREAM_FOOTER_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    ms->data = map;
+    ms->size = st.st_size;
+    if (parse_stream_header(ms->data, &ms->hdr) != 0 ||
+        parse_stream_footer(ms->data + ms->size - STREAM_FOOTER_SIZE, ms->size, &ms->ftr) != 0 ||
+        !(ms->index = malloc((ms->ftr.chunk_count > 0 ? ms->ftr.chunk_count : 1) * sizeof(*ms->index))) ||
+        parse_stream_index(ms->data + ms->ftr.index_offset, &ms->ftr, ms->index) != 0)
+    {
+        free(ms->index);
+        munmap(ms->data, ms->size);
+        memset(ms, 0, sizeof(*ms));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * write_frame - Write one decoded frame in the output format
+ * @ctx: Encoder context
+ * @yuv: Packed YUV420 frame
+ * @format: Pixel format to write
+ * @buf: Frame buffer for the conversion, unused for yuv420p
+ * @out: Output stream
+ *
+ * yuv420p is written straight from the decoded frame, without any
+ * conversion, and NV12 only interleaves the chroma planes.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int write_frame(encoder_context *ctx, const unsigned char *yuv, output_format format, unsigned char *buf,
+                       FILE *out)
+{
+    size_t size = format == OUTPUT_RGB24 ? ctx->frame_size : ctx->yuv_size;
+    const unsigned char *frame = yuv;
+    yuv_frame planes;
+
+    init_packed_frame(ctx, yuv, &planes);
+    if (format == OUTPUT_RGB24)
+        yuv420_to_rgb(ctx, &planes, buf);
+    else if (format == OUTPUT_NV12)
+        yuv420_to_nv12(ctx, &planes, buf);
+    if (buf)
+        frame = buf;
+
+    if (fwrite(frame, 1, size, out) != size)
+    {
+        fprintf(stderr, "Error writing output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * decode_mapped - Decode a mapped stream a chunk per thread at a time
+ * @ctx: Encoder context with its worker pool started
+ * @ms: Mapped stream
+ * @format: Pixel format to write
+ * @buf: Frame buffer for the conversion, unused for yuv420p
+ * @out: Output stream
+ * @frame_count: Pointer to store the number of frames written
+ *
+ * Each decode_frames() call inflates ctx->threads chunks in parallel, so
+ * only that many groups of pictures are held at once however long the
+ * stream is.
+ *
+ * Return: 0 on success, -1 on failure
+ */
+static int decode_mapped(encoder_context *ctx, mapped_stream *ms, output_format format, unsigned char *buf,
+                         FILE *out, int *frame_count)
+{
+    video_frame *frames = NULL;
+    int capacity = 0;
+    int ret = 0;
+
+    *frame_count = 0;
+    for (int k = 0; k < ms->ftr.chunk_count && ret == 0; k += ctx->threads)
+    {
+        int last = k + ctx->threads < ms->ftr.chunk_count ? k + ctx->threads : ms->ftr.chunk_count;
+        int first = ms->index[k].first_frame;
+        int count = ms->index[last - 1].first_frame + ms->index[last - 1].frames - first;
+
+        if (count > capacity)
+        {
+            free(frames);
+            capacity = count;
+            frames = malloc(capacity * sizeof(*frames));
+            if (!frames)
+                return -1;
+        }
+        for (int i = 0; i < count; i++)
+            frames[i].data = NULL;
+
+        ret = decode_frames(ctx, ms->data, ms->size, first, frames, count);
+        for (int i = 0; i < count && ret == 0; i++)
+        {
+            ret = write_frame(ctx, frames[i].data, format, buf, out);
+            if (ret == 0)
+                (*frame_count)++;
+        }
+        for (int i = 0; i < count; i++)
+            arena_free(&ctx->yuv_arena, frames[i].data);
+    }
+    free(frames);
+
+    return ret;
+}
+
+/**
+ * decode_file - Decode a whole stream, or part of it
+ * @ctx: Encoder context, set up from the stream header
+ * @input: Encoded input filename, or - for stdin
+ * @output: Raw video output filename, or - for stdout
+ * @format: Pixel format to write
+ * @colour: Colour conversion to use for RGB24
+ * @threads: Threads for decoding and colour conversion
+ * @first: First frame to decode, -1 for the whole stream
+ * @count: Number of frames to decode from @first, 0 for the rest
+ *
+ * A range needs a seekable input with its index. The stream decoder is
+ * moved to the key frame at or before it with stream_decoder_seek() and
+ * reads on from there in one pass. With more than one thread a whole
+ * seekable input is decoded on the worker pool, a chunk per thread (see
+ * decode_mapped()). Otherwise, or if the input has no index, it is
+ * decoded one frame at a time as it is read. The output is the same
+ * either way.
+ *
+ * Return: 0 on success, 1 on failure
+ */
+static int decode_file(encoder_context *ctx, const char *input, const char *output, output_format format,
+                       colour_path colour, int threads, int first, int count)
+{
+    stream_decoder dec = {0};
+    mapped_stream ms = {0};
+    const unsigned char *yuv;
+    unsigned char *buf = NULL;
+    FILE *in = NULL, *out = NULL;
+    int frame_count = 0;
+    int ret = 1;
+
+    if (first >= 0)
+    {
+        stream_header hdr;
+        stream_footer ftr;
+        chunk_entry *index;
+
+        in = strcmp(input, "-") ? fopen(input, "rb") : NULL;
+        if (!in || read_stream_index(in, &hdr, &ftr, &index) != 0)
+        {
+            fprintf(stderr, "Decoding a range needs a seekable input with an intact index\n");
+            goto cleanup;
+        }
+        free(index);
+
+        if (first >= ftr.frame_count)
+        {
+            fprintf(stderr, "Frame %d out of range, stream has %d\n", first, ftr.frame_count);
+            goto cleanup;
+        }
+        if (count == 0)
+            count = ftr.frame_count - first;
+        if (count > ftr.frame_count - first)
+        {
+            fprintf(stderr, "Frames %d..%ld out of range, stream has %d\n", first, (long)first + count - 1,
+                    ftr.frame_count);
+            goto cleanup;
+        }
+
+        if (fseeko(in, 0, SEEK_SET) != 0 || stream_decoder_init(&dec, ctx, in) != 0 ||
+            stream_decoder_seek(&dec, first) != 0)
+        {
+            fprintf(stderr, "Error seeking to frame %d\n", first);
+            goto cleanup;
+        }
+    }
+    else if (threads > 1 && strcmp(input, "-") != 0 && map_stream(input, &ms) == 0)
+        setup_context(ctx, &ms.hdr);
+    else
+    {
+        in = strcmp(input, "-") ? fopen(input, "rb") : stdin;
+        if (!in)
+        {
+            fprintf(stderr, "Error opening input file\n");
+            return 1;
+        }
+
+        if (stream_decoder_init(&dec, ctx, in) != 0)
+        {
+            fprintf(stderr, "Error reading stream header\n");
+            goto cleanup;
+        }
+    }
+
+    set_colour_path(ctx, colour);
+    if (set_threads(ctx, threads) != 0)
+        fprintf(stderr, "Could not start worker threads, decoding on one\n");
+
+    out = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+    if (format != OUTPUT_YUV420P)
+        buf = arena_alloc(format == OUTPUT_RGB24 ? &ctx->arena : &ctx->yuv_arena);
+    if (!out || (format != OUTPUT_YUV420P && !buf))
+    {
+        fprintf(stderr, "Error opening output file\n");
+        goto cleanup;
+    }
+
+    if (ms.data)
+    {
+        if (decode_mapped(ctx, &ms, format, buf, out, &frame_count) != 0)
+            goto cleanup;
+    }
+    else
+    {
+        /* a range stops after its last frame, a whole stream at its end */
+        while ((first < 0 || frame_count < count) && (yuv = decoder_next_frame(&dec)))
+        {
+            if (write_frame(ctx, yuv, format, buf, out) != 0)
+                goto cleanup;
+            frame_count++;
+        }
+        if (dec.error)
+            goto cleanup;
+    }
+
+    ret = 0;
+    fprintf(stderr, "Decoded %d frames of %dx%d at %.2f fps\n", frame_count, ctx->width, ctx->height, ctx->fps);
+
+cleanup:
+    arena_free(format == OUTPUT_RGB24 ? &ctx->arena : &ctx->yuv_arena, buf);
+    if (out && out != stdout)
+        fclose(out);
+    if (ms.data)
+    {
+        free(ms.index);
+        munmap(ms.data, ms.size);
+    }
+    if (dec.ctx)
+        stream_decoder_free(&dec);
+    if (in && in != stdin)
+        fclose(in);
+
+    return ret;
+}
+
+/**
+ * main - Entry point
+ * @argc: Argument count
+ * @argv: Argument array
+ *
+ * Return: 0 on success, 1 on failure
+ */
+int main(int argc, char **argv)
+{
+    encoder_context ctx;
+    const char *input = "encoded.bin";
+    const char *output = "decoded.rgb24";
+    output_format format = OUTPUT_RGB24;
+    colour_path colour = COLOUR_SIMD;
+    int threads = 1;
+    int first = -1, count = 0;
+    int ret;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:c:t:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                if (strcmp(optarg, "rgb24") == 0)
+                    format = OUTPUT_RGB24;
+                else if (strcmp(optarg, "yuv420p") == 0)
+                    format = OUTPUT_YUV420P;
+                else if (strcmp(optarg, "nv12") == 0)
+                    format = OUTPUT_NV12;
+                else
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (strcmp(optarg, "simd") == 0)
+                    colour = COLOUR_SIMD;
+                else if (strcmp(optarg, "fixed") == 0)
+                    colour = COLOUR_FIXED;
+                else if (strcmp(optarg, "float") == 0)
+                    colour = COLOUR_FLOAT;
+                else
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'r':
+                if (parse_range(optarg, &first, &count) != 0)
+                {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc)
+        input = argv[optind++];
+    if (optind < argc)
+        output = argv[optind++];
+
+    /* sized from the stream header */
+    memset(&ctx, 0, sizeof(ctx));
+    ret = decode_file(&ctx, input, output, format, colour, threads, first, count);
+    free_encoder(&ctx);
+
+    return ret;
+}
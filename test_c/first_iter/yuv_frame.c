@@ -0,0 +1,162 @@
+// yuv_frame.c
+#include "codec.h"
+
+/**
+ * plane_size - Size of one padded plane
+ * @width: Visible samples per row
+ * @height: Visible rows
+ * @border: Samples of border on every side
+ * @left: Pointer to store the offset of the first visible sample in a row
+ * @stride: Pointer to store the bytes per row
+ *
+ * The left border is rounded up to FRAME_ALIGN so visible rows start
+ * aligned, and the stride is rounded up so every row does.
+ *
+ * Return: Size of the plane in bytes, a multiple of FRAME_ALIGN
+ */
+static size_t plane_size(int width, int height, int border, int *left, int *stride)
+{
+    *left = (border + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN;
+    *stride = (*left + width + border + FRAME_ALIGN - 1) / FRAME_ALIGN * FRAME_ALIGN;
+
+    return (size_t)*stride * (height + 2 * border);
+}
+
+/**
+ * plane_border - Border of one plane
+ * @border: Border of the Y plane
+ * @p: Plane, 0 for Y
+ *
+ * Return: Samples of border on every side of plane @p
+ */
+static int plane_border(int border, int p)
+{
+    return p ? (border + 1) / 2 : border;
+}
+
+/**
+ * init_packed_frame - Describe a packed YUV420 frame
+ * @ctx: Encoder context
+ * @data: Frame, ctx->yuv_size bytes
+ * @frame: Descriptor to fill in
+ *
+ * Packed is the layout of frames in a stream. @data is only written
+ * through @frame when it is passed as an output.
+ */
+void init_packed_frame(encoder_context *ctx, const unsigned char *data, yuv_frame *frame)
+{
+    size_t luma = (size_t)ctx->width * ctx->height;
+    size_t chroma = (size_t)ctx->chroma_width * ctx->chroma_height;
+
+    frame->data = (unsigned char *)data;
+    frame->plane[0] = frame->data;
+    frame->plane[1] = frame->data + luma;
+    frame->plane[2] = frame->data + luma + chroma;
+    frame->border = 0;
+
+    for (int p = 0; p < 3; p++) {
+        frame->width[p] = p ? ctx->chroma_width : ctx->width;
+        frame->height[p] = p ? ctx->chroma_height : ctx->height;
+        frame->stride[p] = frame->width[p];
+    }
+}
+
+/**
+ * padded_frame_size - Size of a padded YUV420 frame
+ * @ctx: Encoder context
+ * @border: Samples of border around the Y plane
+ *
+ * Return: Bytes needed by init_padded_frame()
+ */
+size_t padded_frame_size(encoder_context *ctx, int border)
+{
+    size_t size = 0;
+    int left, stride;
+
+    for (int p = 0; p < 3; p++)
+        size += plane_size(p ? ctx->chroma_width : ctx->width, p ? ctx->chroma_height : ctx->height,
+                           plane_border(border, p), &left, &stride);
+
+    return size;
+}
+
+/**
+ * init_padded_frame - Describe a padded YUV420 frame
+ * @ctx: Encoder context
+ * @data: Buffer of padded_frame_size() bytes aligned to FRAME_ALIGN,
+ * e.g. from the arena
+ * @border: Samples of border around the Y plane
+ * @frame: Descriptor to fill in
+ *
+ * Every row of every plane starts on a FRAME_ALIGN boundary, whatever the
+ * width. The border is left unset, see extend_frame_border().
+ */
+void init_padded_frame(encoder_context *ctx, unsigned char *data, int border, yuv_frame *frame)
+{
+    unsigned char *base = data;
+
+    frame->data = data;
+    frame->border = border;
+
+    for (int p = 0; p < 3; p++) {
+        int b = plane_border(border, p);
+        int left, stride;
+        size_t size;
+
+        frame->width[p] = p ? ctx->chroma_width : ctx->width;
+        frame->height[p] = p ? ctx->chroma_height : ctx->height;
+        size = plane_size(frame->width[p], frame->height[p], b, &left, &stride);
+
+        frame->stride[p] = stride;
+        frame->plane[p] = base + (size_t)b * stride + left;
+        base += size;
+    }
+}
+
+/**
+ * copy_frame_planes - Copy the visible samples of one frame to another
+ * @dst: Destination frame
+ * @src: Source frame of the same size, in any layout
+ */
+void copy_frame_planes(yuv_frame *dst, const yuv_frame *src)
+{
+    for (int p = 0; p < 3; p++) {
+        for (int i = 0; i < src->height[p]; i++)
+            memcpy(dst->plane[p] + (size_t)i * dst->stride[p], src->plane[p] + (size_t)i * src->stride[p],
+                   src->width[p]);
+    }
+}
+
+/**
+ * extend_frame_border - Fill the border of a padded frame
+ * @frame: Padded frame
+ *
+ * The edge samples of every plane are repeated out into its border, so
+ * a search may read a block that reaches past the edge of the picture.
+ */
+void extend_frame_border(yuv_frame *frame)
+{
+    for (int p = 0; p < 3; p++) {
+        int b = plane_border(frame->border, p);
+        int width = frame->width[p];
+        int stride = frame->stride[p];
+        unsigned char *row = frame->plane[p];
+
+        if (b == 0 || width == 0 || frame->height[p] == 0)
+            continue;
+
+        for (int i = 0; i < frame->height[p]; i++, row += stride) {
+            memset(row - b, row[0], b);
+            memset(row + width, row[width - 1], b);
+        }
+
+        /* top and bottom rows, corners included */
+        for (int i = 1; i <= b; i++) {
+            unsigned char *top = frame->plane[p] - b;
+            unsigned char *bottom = frame->plane[p] + (size_t)(frame->height[p] - 1) * stride - b;
+
+            memcpy(top - (size_t)i * stride, top, width + 2 * b);
+            memcpy(bottom + (size_t)i * stride, bottom, width + 2 * b);
+        }
+    }
+}